@@ -1,18 +1,31 @@
 #ifndef AGENT_H
 #define AGENT_H
 
+#include <atomic>
 #include <vector>
 #include "disk.h"
 #include "bitBoard.h"
+#include "evalWeights.h"
+#include "positionCache.h"
+#include "transpositionTable.h"
 using namespace std;
 
+// a column with its exact score and the moves expected to follow it
+struct PrincipalVariation {
+  int column;
+  int score;
+  // starts with column, then alternates between the players
+  vector<int> moves;
+};
+
 // class for preparing to make a move using the player's disk and the board
 class Agent {
 public:
   Agent() {}
-  Agent(BitBoard *boardP, Disk player) {
+  Agent(BitBoard *boardP, Disk player, TranspositionTable *tableP = nullptr) {
     this->boardP = boardP;
     this->player = player;
+    this->tableP = tableP;
   }
 
   // returns whether the state is a victory for the current player
@@ -56,9 +69,11 @@ public:
   // returns agent of a board where the current player added a disk to the
   // column
   Agent nextAgent(int column) {
-    Disk nextPlayer = player.counterpart();
+    // the opponent shares our board, table, and search settings
+    Agent opponent = *this;
+    opponent.player = player.counterpart();
     boardP->addDisk(player, column);
-    return Agent(boardP, nextPlayer);
+    return opponent;
   }
 
   // default search depth
@@ -68,6 +83,16 @@ public:
   // default maximum score
   static constexpr int DEFAULT_BETA = 1 << 30;
 
+  // late move reductions
+  // https://www.chessprogramming.org/Late_Move_Reductions
+  // number of moves searched at full depth before later ones are reduced
+  static constexpr int FULL_DEPTH_MOVES = 4;
+  // minimum requiredDepth to reduce moves at
+  static constexpr int REDUCTION_DEPTH = 4;
+  // plies taken off a reduced move, even so that the reduced search ends on
+  // the same player's heuristic score as the full one
+  static constexpr int REDUCTION = 2;
+
   // maps an index from 0 to 7 into a row alternating away from center
   // i.e. { 0, 1, ..., 7 } to { 4, 3, 5, 2, 6, 1, 7, 0 }
   static int alternatingColumn(int index) {
@@ -95,6 +120,10 @@ public:
     // use recursion to find the scores of the future positions
     // if depth == maxDepth, do not evaluate any future positions
 
+    // the score doesn't matter once the search is stopped
+    if (stopped())
+      return 0;
+
     if (currentWinningMoves().size() > 0) {
       return DEFAULT_BETA;
     }
@@ -109,7 +138,64 @@ public:
              board.adjacencyScore(player.counterpart());
     }
 
+    // positions that were already searched deep enough can return early
+    // otherwise, the best column found before is searched first
+    // the on-disk cache is only checked if the table doesn't have a deep
+    // enough entry, and only for deep searches
+    unsigned long long key = 0;
+    int firstCol = TableEntry::NO_COLUMN;
+    bool useCache = cacheP && requiredDepth >= cacheP->getMinDepth() &&
+                    cacheP->getFingerprint() == searchFingerprint();
+    if (tableP || useCache) {
+      key = boardP->key();
+      TableEntry entry;
+      bool found = tableP && tableP->probe(key, entry);
+      if (useCache && (!found || entry.depth < requiredDepth)) {
+        TableEntry cached;
+        if (cacheP->probe(key, cached) &&
+            (!found || cached.depth > entry.depth)) {
+          entry = cached;
+          found = true;
+          if (tableP)
+            tableP->store(key, entry);
+        }
+      }
+      if (found) {
+        if (entry.depth >= requiredDepth &&
+            (entry.bound == EXACT_BOUND ||
+             (entry.bound == LOWER_BOUND && entry.score >= beta) ||
+             (entry.bound == UPPER_BOUND && entry.score <= alpha)))
+          return entry.score;
+        firstCol = entry.column;
+      }
+    }
+    // the children's entries are usually not in the cache yet
+    // children at depth 0 return the heuristic score without probing
+    if (tableP && requiredDepth > 1)
+      for (int col = 0; col < 8; ++col)
+        if (boardP->validMove(col))
+          tableP->prefetch(boardP->keyAfter(player, col));
+
+    int originalAlpha = alpha;
     int score = DEFAULT_ALPHA;
+    int bestCol = TableEntry::NO_COLUMN;
+    int searched = 0;
+
+    if (firstCol != TableEntry::NO_COLUMN && boardP->validMove(firstCol)) {
+      score = evaluatePositionAfterMove(firstCol, alpha, beta, requiredDepth);
+      bestCol = firstCol;
+      ++searched;
+    }
+
+    // columns where the opponent could win immediately, which must not be
+    // reduced since we have to block them
+    vector<int> opponentWinningMoves;
+    bool reduce = lateMoveReductions && requiredDepth >= REDUCTION_DEPTH;
+    if (reduce) {
+      Agent opponent = *this;
+      opponent.player = player.counterpart();
+      opponentWinningMoves = opponent.currentWinningMoves();
+    }
 
     // if the opponent's worst possible score by our move is worse than our
     // worst possible score, we'll assume the opponent won't let us get to this
@@ -118,17 +204,63 @@ public:
       // start searching near the center first
       // alternate between left and right of center
       int col = alternatingColumn(i);
-      if (boardP->validMove(col)) {
-        int scoreAfterMove =
-            evaluatePositionAfterMove(col, alpha, beta, requiredDepth);
-        if (scoreAfterMove > score)
+      if (col != firstCol && boardP->validMove(col)) {
+        int scoreAfterMove;
+        // late quiet moves are rarely best, so they're searched shallower
+        // first and only searched fully if they might raise alpha
+        if (reduce && searched >= FULL_DEPTH_MOVES &&
+            !isTactical(col, opponentWinningMoves)) {
+          int reducedAlpha = alpha;
+          scoreAfterMove = evaluatePositionAfterMove(
+              col, reducedAlpha, beta, requiredDepth - REDUCTION);
+          if (scoreAfterMove > alpha)
+            scoreAfterMove =
+                evaluatePositionAfterMove(col, alpha, beta, requiredDepth);
+        } else {
+          scoreAfterMove =
+              evaluatePositionAfterMove(col, alpha, beta, requiredDepth);
+        }
+        ++searched;
+        if (scoreAfterMove > score) {
           score = scoreAfterMove;
+          bestCol = col;
+        }
       }
     }
 
+    // scores of stopped searches are incomplete, so they aren't stored
+    if ((tableP || useCache) && !stopped()) {
+      TableEntry entry;
+      entry.score = score;
+      entry.depth = requiredDepth;
+      entry.column = bestCol;
+      if (score >= beta)
+        entry.bound = LOWER_BOUND;
+      else if (score <= originalAlpha)
+        entry.bound = UPPER_BOUND;
+      else
+        entry.bound = EXACT_BOUND;
+      if (tableP)
+        tableP->store(key, entry);
+      if (useCache)
+        cacheP->store(key, entry);
+    }
+
     return score;
   }
 
+  // returns whether the move blocks one of the opponent's winning moves or
+  // gives us a winning move next turn
+  bool isTactical(int col, const vector<int> &opponentWinningMoves) {
+    for (int winningCol : opponentWinningMoves)
+      if (winningCol == col)
+        return true;
+    boardP->addDisk(player, col);
+    bool threat = currentWinningMoves().size() > 0;
+    boardP->popDisk(player, col);
+    return threat;
+  }
+
   // evaluates the position after a hypothetical move from the player is made
   // order of parameters is for default parameters used in chooseColumn()
   int evaluatePositionAfterMove(int col, int &alpha, int beta = DEFAULT_BETA,
@@ -152,6 +284,8 @@ public:
 
   // chooses a column to add to
   int chooseColumn() {
+    if (tableP)
+      tableP->newSearch();
     for (int i = 0; i < 2; ++i, player.alternate()) {
       vector<int> winningMoves = currentWinningMoves();
       // return the first winning move if there is one
@@ -160,38 +294,186 @@ public:
         return winningMoves.front();
     }
 
+    int scores[8];
+    int bestCol = searchColumns(scores, depth);
+
+    cout << "scores: ";
+    for (int i : scores)
+      cout << i << ' ';
+    cout << '\n';
+
+    return bestCol;
+  }
+
+  // searches every column to requiredDepth, storing their scores in scores
+  // returns the column with the best score
+  int searchColumns(int scores[8], int requiredDepth) {
     unsigned char bestCol = 4;
     int alpha = DEFAULT_ALPHA;
-    int scores[8];
-    for (unsigned char i = 0; i < 8; ++i) {
+    for (unsigned char i = 0; i < 8 && !stopped(); ++i) {
       int col = alternatingColumn(i);
       // to avoid invalid moves
       // an invalid move has a worse score than all valid ones
       scores[col] = DEFAULT_ALPHA - 1;
 
       if (boardP->validMove(col)) {
-        int score = scores[col] = evaluatePositionAfterMove(col, alpha);
+        int score = scores[col] =
+            evaluatePositionAfterMove(col, alpha, DEFAULT_BETA, requiredDepth);
         // choose move with best score
         if (score > scores[bestCol]) {
           bestCol = col;
         }
       }
     }
+    return bestCol;
+  }
 
-    cout << "scores: ";
-    for (int i : scores)
-      cout << i << ' ';
-    cout << '\n';
+  // returns the best columns, up to lines of them, with exact scores to
+  // requiredDepth, best first
+  // the scores in chooseColumn() are only upper bounds after the first, since
+  // alpha is shared between columns. here, each column is first tested with a
+  // null window against the worst score kept so far, and only searched with a
+  // full window if it's better, so most columns cost a cheap search. with a
+  // transposition table, the searches reuse each other's results and the
+  // moves after each column are read from it
+  vector<PrincipalVariation> searchPrincipalVariations(int lines,
+                                                      int requiredDepth) {
+    if (lines <= 0)
+      return {};
+    // late move reductions depend on the window, so the scores would differ
+    // from full window searches of each column with them
+    bool reductions = lateMoveReductions;
+    lateMoveReductions = false;
+    vector<PrincipalVariation> variations;
+    for (unsigned char i = 0; i < 8 && !stopped(); ++i) {
+      int col = alternatingColumn(i);
+      if (!boardP->validMove(col))
+        continue;
+      bool full = (int)variations.size() == lines;
+      int worst = full ? variations.back().score : DEFAULT_ALPHA;
+      int score;
+      // searches don't notice a win by the move before them
+      if (winsImmediately(col)) {
+        score = DEFAULT_BETA;
+      } else {
+        int alpha = worst;
+        if (full &&
+            evaluatePositionAfterMove(col, alpha, worst + 1, requiredDepth) <=
+                worst)
+          continue;
+        alpha = worst;
+        score = evaluatePositionAfterMove(col, alpha, DEFAULT_BETA,
+                                          requiredDepth);
+        // only an upper bound, if a table entry made the searches disagree
+        if (full && score <= worst)
+          continue;
+      }
 
-    return bestCol;
+      PrincipalVariation variation{col, score,
+                                   principalMoves(col, requiredDepth)};
+      // after the ones with equal scores, so earlier columns are preferred
+      auto position = variations.begin();
+      while (position != variations.end() && position->score >= score)
+        ++position;
+      variations.insert(position, variation);
+      if ((int)variations.size() > lines)
+        variations.pop_back();
+    }
+    lateMoveReductions = reductions;
+    return variations;
+  }
+
+  // returns whether adding a disk to the column wins immediately
+  bool winsImmediately(int col) {
+    boardP->addDisk(player, col);
+    bool won = boardP->checkWin(boardP->getLocations(player));
+    boardP->popDisk(player, col);
+    return won;
   }
 
+  // returns the column followed by the best moves after it stored in the
+  // transposition table, up to requiredDepth moves in total
+  vector<int> principalMoves(int col, int requiredDepth) {
+    vector<int> moves{col};
+    Disk disk = player;
+    boardP->addDisk(disk, col);
+    while (tableP && (int)moves.size() < requiredDepth &&
+           boardP->getState() == INCOMPLETE) {
+      disk.alternate();
+      // searches return at immediate wins without storing them
+      Agent next(boardP, disk);
+      vector<int> winningMoves = next.currentWinningMoves();
+      int nextCol = TableEntry::NO_COLUMN;
+      TableEntry entry;
+      if (winningMoves.size())
+        nextCol = winningMoves.front();
+      else if (tableP->probe(boardP->key(), entry))
+        nextCol = entry.column;
+      if (nextCol == TableEntry::NO_COLUMN || !boardP->validMove(nextCol)) {
+        disk.alternate();
+        break;
+      }
+      boardP->addDisk(disk, nextCol);
+      moves.push_back(nextCol);
+    }
+    // undoes the moves, last first
+    for (size_t i = moves.size(); i-- > 0; disk.alternate())
+      boardP->popDisk(disk, moves[i]);
+    return moves;
+  }
+
+  // identifies what scores depend on besides the position: the heuristic's
+  // weights, the hash of positions, and the search settings, so results kept
+  // by a PositionCache aren't used by a different search
+  unsigned long long searchFingerprint() const {
+    static const unsigned long long evaluation = [] {
+      // BitBoard::key() combines them, so a different hash changes it too
+      unsigned long long fingerprint = BitBoard::key(0, 0);
+      for (const auto &weights : EVAL_WEIGHTS.adjacency)
+        for (int weight : weights)
+          fingerprint = BitBoard::key(fingerprint, weight);
+      return fingerprint;
+    }();
+    unsigned long long settings = 0;
+    if (lateMoveReductions)
+      settings = FULL_DEPTH_MOVES | REDUCTION_DEPTH << 8 | REDUCTION << 16;
+    return BitBoard::key(evaluation, settings);
+  }
+
+  BitBoard *getBoardP() const { return boardP; }
   void setBoardP(BitBoard *boardP) { this->boardP = boardP; }
   void setPlayer(Disk player) { this->player = player; }
+  // shares the table between all agents given it, on any thread
+  void setTableP(TranspositionTable *tableP) { this->tableP = tableP; }
+  // shares the on-disk cache between all agents given it, on any thread
+  // it's only used while its fingerprint is searchFingerprint()
+  void setCacheP(PositionCache *cacheP) { this->cacheP = cacheP; }
+  // sets how many moves after ours chooseColumn() considers
+  void setDepth(int depth) { this->depth = depth; }
+  void setLateMoveReductions(bool enabled) { lateMoveReductions = enabled; }
+  // searches stop soon after *stopP becomes true, see stopped()
+  void setStopP(const atomic<bool> *stopP) { this->stopP = stopP; }
+
+  // returns whether the search was asked to stop, in which case its scores
+  // are meaningless
+  bool stopped() const {
+    return stopP && stopP->load(memory_order_relaxed);
+  }
 
 private:
   BitBoard *boardP;
   Disk player;
+  // searched positions, or nullptr to search without a table
+  TranspositionTable *tableP = nullptr;
+  // searched positions kept between runs, or nullptr to not use one
+  PositionCache *cacheP = nullptr;
+  // search depth used by chooseColumn()
+  int depth = DEFAULT_DEPTH;
+  // whether late moves are searched at a reduced depth first, which only
+  // helps searches that deepen until a time budget runs out
+  bool lateMoveReductions = false;
+  // checked at every position, or nullptr if the search can't be stopped
+  const atomic<bool> *stopP = nullptr;
 };
 
 #endif /* AGENT_H */
@@ -0,0 +1,51 @@
+// prints the best columns of a position with exact scores and the moves
+// expected after them
+//
+// ./analyze [moves] [lines] [depth]
+//   moves is a string of columns from 1 to 8 like main.cpp's inputs, and
+//   lines is how many columns to print, 3 by default
+#include <string>
+#include <vector>
+
+#include "agent.h"
+#include "bitBoard.h"
+#include "disk.h"
+#include "transpositionTable.h"
+
+int main(int argc, char *argv[]) {
+  BitBoard board;
+  string moves = argc >= 2 ? argv[1] : "";
+  size_t added = board.addMoves(moves);
+  if (added < moves.size()) {
+    cout << "invalid move: " << moves[added] << '\n';
+    return 1;
+  }
+  Disk disk = board.nextDisk();
+  int lines = argc >= 3 ? stoi(argv[2]) : 3;
+  int depth = argc >= 4 ? stoi(argv[3]) : Agent::DEFAULT_DEPTH;
+  if (lines <= 0) {
+    cout << "lines must be at least 1\n";
+    return 1;
+  }
+
+  cout << string(board);
+  if (board.getState() != INCOMPLETE) {
+    cout << "the game is over\n";
+    return 0;
+  }
+
+  TranspositionTable table(256);
+  Agent agent(&board, disk, &table);
+  vector<PrincipalVariation> variations =
+      agent.searchPrincipalVariations(lines, depth);
+
+  cout << disk << " to move, depth " << depth << '\n';
+  for (const PrincipalVariation &variation : variations) {
+    cout << "column " << variation.column + 1 << ": score " << variation.score
+         << ", moves";
+    for (int col : variation.moves)
+      cout << ' ' << col + 1;
+    cout << '\n';
+  }
+  return 0;
+}
@@ -0,0 +1,236 @@
+#ifndef ASYNCSEARCH_H
+#define ASYNCSEARCH_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "agent.h"
+#include "bitBoard.h"
+#include "disk.h"
+#include "transpositionTable.h"
+using namespace std;
+
+// best column found by a search after completing a depth
+struct SearchUpdate {
+  // depth the column was searched to, 0 for immediate wins and blocks
+  int depth = 0;
+  int column = -1;
+  int score = 0;
+};
+
+// refers to a search started by AsyncSearcher
+// every member function returns immediately except wait()
+// only AsyncSearcher::search() makes them, so they always refer to a search
+class SearchHandle {
+public:
+  // moves the oldest update not yet polled into update, returning whether
+  // there was one
+  bool poll(SearchUpdate &update) {
+    lock_guard<mutex> lock(state->lock);
+    if (state->updates.empty())
+      return false;
+    update = state->updates.front();
+    state->updates.pop_front();
+    return true;
+  }
+
+  // asks the search to stop, which it does within one position's work
+  // the best update so far remains available
+  void cancel() { state->stop.store(true, memory_order_relaxed); }
+
+  // returns whether no more updates will be made
+  bool finished() const { return state->finished.load(); }
+
+  // returns the update from the deepest completed search so far, which has
+  // column -1 if there hasn't been one
+  SearchUpdate best() const {
+    lock_guard<mutex> lock(state->lock);
+    return state->best;
+  }
+
+  // blocks until the search finishes and returns its best update
+  SearchUpdate wait() const {
+    unique_lock<mutex> lock(state->lock);
+    state->finishedCondition.wait(lock,
+                                  [this] { return state->finished.load(); });
+    return state->best;
+  }
+
+private:
+  // shared with the thread doing the search
+  struct State {
+    mutable mutex lock;
+    condition_variable finishedCondition;
+    deque<SearchUpdate> updates;
+    SearchUpdate best;
+    atomic<bool> stop{false};
+    atomic<bool> finished{false};
+    // called on the searching thread for every update, if not empty
+    function<void(const SearchUpdate &)> onUpdate;
+  };
+
+  SearchHandle(shared_ptr<State> state) : state(state) {}
+
+  shared_ptr<State> state;
+
+  friend class AsyncSearcher;
+};
+
+// runs searches on a pool of threads so a single thread, like an event loop,
+// can start, poll, and cancel searches for many games without blocking
+// each search deepens one depth at a time, making an update after each one
+class AsyncSearcher {
+public:
+  // entries of the table are made older at most this often while searches
+  // keep running, instead of by every search, which would make the entries of
+  // the other searches running look old
+  static constexpr chrono::seconds AGING_INTERVAL{1};
+
+  // tableP is shared by every search if it isn't nullptr
+  AsyncSearcher(unsigned threads = thread::hardware_concurrency(),
+                TranspositionTable *tableP = nullptr)
+      : tableP(tableP) {
+    if (threads == 0)
+      threads = 1;
+    for (unsigned i = 0; i < threads; ++i)
+      workers.emplace_back([this] { work(); });
+  }
+  AsyncSearcher(const AsyncSearcher &) = delete;
+  AsyncSearcher &operator=(const AsyncSearcher &) = delete;
+
+  // cancels every search and waits for the threads to exit
+  ~AsyncSearcher() {
+    {
+      lock_guard<mutex> lock(queueLock);
+      exiting = true;
+      for (Job &job : jobs)
+        job.state->stop.store(true, memory_order_relaxed);
+      for (const shared_ptr<SearchHandle::State> &state : running)
+        state->stop.store(true, memory_order_relaxed);
+    }
+    queueCondition.notify_all();
+    for (thread &worker : workers)
+      worker.join();
+  }
+
+  // starts searching for the player's move on a copy of the board, up to
+  // maxDepth
+  // onUpdate, if given, is called on the searching thread with every update
+  SearchHandle
+  search(const BitBoard &board, Disk player,
+         int maxDepth = Agent::DEFAULT_DEPTH,
+         function<void(const SearchUpdate &)> onUpdate = nullptr) {
+    auto state = make_shared<SearchHandle::State>();
+    state->onUpdate = move(onUpdate);
+    {
+      lock_guard<mutex> lock(queueLock);
+      jobs.push_back({board, player, maxDepth, state});
+    }
+    queueCondition.notify_one();
+    return SearchHandle(state);
+  }
+
+private:
+  struct Job {
+    BitBoard board;
+    Disk player;
+    int maxDepth;
+    shared_ptr<SearchHandle::State> state;
+  };
+
+  void work() {
+    while (true) {
+      Job job;
+      {
+        unique_lock<mutex> lock(queueLock);
+        queueCondition.wait(lock, [this] { return exiting || !jobs.empty(); });
+        if (jobs.empty())
+          return;
+        job = move(jobs.front());
+        jobs.pop_front();
+        // a search started when none are running begins a new batch
+        auto now = chrono::steady_clock::now();
+        if (tableP && (running.empty() || now - lastAging >= AGING_INTERVAL)) {
+          tableP->newSearch();
+          lastAging = now;
+        }
+        running.push_back(job.state);
+      }
+      run(job);
+      {
+        lock_guard<mutex> lock(queueLock);
+        for (size_t i = 0; i < running.size(); ++i)
+          if (running[i] == job.state) {
+            running[i] = running.back();
+            running.pop_back();
+            break;
+          }
+      }
+      {
+        lock_guard<mutex> lock(job.state->lock);
+        job.state->finished.store(true);
+      }
+      job.state->finishedCondition.notify_all();
+    }
+  }
+
+  // iterative deepening until maxDepth or cancellation
+  void run(Job &job) {
+    SearchHandle::State &state = *job.state;
+    Agent agent(&job.board, job.player, tableP);
+    agent.setStopP(&state.stop);
+    // they let each depth finish sooner, before a search is cancelled
+    agent.setLateMoveReductions(true);
+
+    // immediate wins and blocks don't need a search, like chooseColumn()
+    for (int i = 0; i < 2; ++i) {
+      Agent mover(&job.board, i ? job.player.counterpart() : job.player);
+      vector<int> winningMoves = mover.currentWinningMoves();
+      if (winningMoves.size()) {
+        // blocking moves aren't scored
+        int score = i ? 0 : Agent::DEFAULT_BETA;
+        publish(state, {0, winningMoves.front(), score});
+        return;
+      }
+    }
+
+    for (int depth = 1; depth <= job.maxDepth; ++depth) {
+      int scores[8];
+      int col = agent.searchColumns(scores, depth);
+      // the last depth is incomplete if it was cancelled
+      if (agent.stopped())
+        return;
+      publish(state, {depth, col, scores[col]});
+    }
+  }
+
+  void publish(SearchHandle::State &state, const SearchUpdate &update) {
+    {
+      lock_guard<mutex> lock(state.lock);
+      state.updates.push_back(update);
+      state.best = update;
+    }
+    if (state.onUpdate)
+      state.onUpdate(update);
+  }
+
+  TranspositionTable *tableP;
+  vector<thread> workers;
+  mutex queueLock;
+  condition_variable queueCondition;
+  // searches that haven't started yet
+  deque<Job> jobs;
+  // states of searches in progress, to cancel them on destruction
+  vector<shared_ptr<SearchHandle::State>> running;
+  // when the table was last made older
+  chrono::steady_clock::time_point lastAging;
+  bool exiting = false;
+};
+
+#endif /* ASYNCSEARCH_H */
@@ -0,0 +1,323 @@
+#ifndef BATCHEVALUATOR_H
+#define BATCHEVALUATOR_H
+
+#include <cstddef>
+#include <vector>
+#include "disk.h"
+#include "board.h"
+#include "bitBoard.h"
+#include "evalWeights.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BATCHEVALUATOR_AVX2
+#endif
+using namespace std;
+
+// everything evaluatePosition() needs from a leaf, computed at once
+struct LeafEvaluation {
+  // type of victory, TIE, or INCOMPLETE, same as BitBoard::getState()
+  GAME_STATE state = INCOMPLETE;
+  // playable locations that would win immediately, indexed by DISK_TYPE
+  unsigned long long threats[2] = {};
+  // BitBoard::adjacencyScore() for each disk type, indexed by DISK_TYPE
+  int adjacency[2] = {};
+};
+
+// evaluates many independent BitBoards together
+// the AVX2 kernel handles 4 boards per instruction stream, one in each 64-bit
+// lane, and is only used if the CPU supports it when the program runs
+class BatchEvaluator {
+public:
+  // number of boards evaluated together by the AVX2 kernel
+  static constexpr size_t LANES = 4;
+
+  // evaluates count boards into results using the fastest supported kernel
+  // adjacency scores use the given weights instead of EVAL_WEIGHTS, for tuning
+  static void evaluate(const BitBoard *boards, size_t count,
+                       LeafEvaluation *results,
+                       const EvalWeights &weights = EVAL_WEIGHTS) {
+#ifdef BATCHEVALUATOR_AVX2
+    if (avx2Supported()) {
+      evaluateAVX2(boards, count, results, weights);
+      return;
+    }
+#endif
+    evaluateScalar(boards, count, results, weights);
+  }
+
+  static vector<LeafEvaluation>
+  evaluate(const vector<BitBoard> &boards,
+           const EvalWeights &weights = EVAL_WEIGHTS) {
+    vector<LeafEvaluation> results(boards.size());
+    evaluate(boards.data(), boards.size(), results.data(), weights);
+    return results;
+  }
+
+  // returns whether the AVX2 kernel can be used on this CPU
+  static bool avx2Supported() {
+#ifdef BATCHEVALUATOR_AVX2
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+  }
+
+  // evaluates one board at a time on 64-bit integers
+  static void evaluateScalar(const BitBoard *boards, size_t count,
+                             LeafEvaluation *results,
+                             const EvalWeights &weights = EVAL_WEIGHTS) {
+    for (size_t i = 0; i < count; ++i) {
+      unsigned long long locations[2] = {
+          boards[i].getXLocations().to_ullong(),
+          boards[i].getOLocations().to_ullong()};
+      unsigned long long occupied = locations[0] | locations[1];
+      unsigned long long playable = playableLocations(occupied);
+      LeafEvaluation &result = results[i];
+      bool wins[2];
+      for (int type = 0; type < 2; ++type) {
+        unsigned long long spots = 0;
+        wins[type] = false;
+        for (const Direction &direction : DIRECTIONS) {
+          wins[type] |= chainStarts(locations[type], direction) != 0;
+          spots |= winningSpots(locations[type], direction);
+        }
+        result.threats[type] = spots & playable;
+        result.adjacency[type] = 0;
+        for (int i = 0; i < WEIGHT_DIRECTIONS; ++i)
+          result.adjacency[type] += adjacencyScore(
+              locations[type], DIRECTIONS[i], weights.adjacency[i]);
+      }
+      result.state = gameState(wins[0], wins[1], occupied == ~0ULL);
+    }
+  }
+
+#ifdef BATCHEVALUATOR_AVX2
+  // evaluates LANES boards at a time, with the remainder done by the scalar
+  // kernel
+  __attribute__((target("avx2"))) static void
+  evaluateAVX2(const BitBoard *boards, size_t count, LeafEvaluation *results,
+               const EvalWeights &weights = EVAL_WEIGHTS) {
+    size_t batched = count - count % LANES;
+    for (size_t i = 0; i < batched; i += LANES) {
+      alignas(32) unsigned long long x[LANES], o[LANES];
+      for (size_t lane = 0; lane < LANES; ++lane) {
+        x[lane] = boards[i + lane].getXLocations().to_ullong();
+        o[lane] = boards[i + lane].getOLocations().to_ullong();
+      }
+      __m256i locations[2] = {_mm256_load_si256((const __m256i *)x),
+                              _mm256_load_si256((const __m256i *)o)};
+      __m256i occupied = _mm256_or_si256(locations[0], locations[1]);
+      // empty locations directly above a disk or in the bottom row
+      __m256i playable = _mm256_andnot_si256(
+          occupied, _mm256_or_si256(shiftLeft(occupied, 8),
+                                    _mm256_set1_epi64x(0xFF)));
+
+      alignas(32) unsigned long long threats[2][LANES];
+      alignas(32) long long adjacency[2][LANES];
+      int winLanes[2];
+      for (int type = 0; type < 2; ++type) {
+        __m256i chains = _mm256_setzero_si256();
+        __m256i spots = _mm256_setzero_si256();
+        __m256i score = _mm256_setzero_si256();
+        for (int i = 0; i < WEIGHT_DIRECTIONS; ++i) {
+          const Direction &direction = DIRECTIONS[i];
+          chains = _mm256_or_si256(chains,
+                                   chainStarts(locations[type], direction));
+          spots = _mm256_or_si256(spots,
+                                  winningSpots(locations[type], direction));
+          score = _mm256_add_epi64(
+              score, adjacencyScore(locations[type], direction,
+                                    weights.adjacency[i]));
+        }
+        winLanes[type] = nonzeroLanes(chains);
+        _mm256_store_si256((__m256i *)threats[type],
+                           _mm256_and_si256(spots, playable));
+        _mm256_store_si256((__m256i *)adjacency[type], score);
+      }
+      int fullLanes = _mm256_movemask_pd(_mm256_castsi256_pd(
+          _mm256_cmpeq_epi64(occupied, _mm256_set1_epi64x(-1))));
+
+      for (size_t lane = 0; lane < LANES; ++lane) {
+        LeafEvaluation &result = results[i + lane];
+        for (int type = 0; type < 2; ++type) {
+          result.threats[type] = threats[type][lane];
+          result.adjacency[type] = adjacency[type][lane];
+        }
+        result.state =
+            gameState(winLanes[0] >> lane & 1, winLanes[1] >> lane & 1,
+                      fullLanes >> lane & 1);
+      }
+    }
+    evaluateScalar(boards + batched, count - batched, results + batched,
+                   weights);
+  }
+#endif
+
+private:
+  // a direction that 4-in-a-row chains can be in
+  struct Direction {
+    // distance between adjacent locations in the chain
+    unsigned shift;
+    // locations that a 4-in-a-row chain can start from
+    unsigned long long chainMask;
+    // locations that remain adjacent after shifting
+    unsigned long long adjacencyMask;
+  };
+
+  // the same directions and masks as BitBoard's checks and adjacency scores
+  static inline const Direction DIRECTIONS[4] = {
+      // horizontal
+      {1, BitBoard::horizontal4ChainMask().to_ullong(),
+       BitBoard::horizontalAdjacencyMask().to_ullong()},
+      // vertical
+      {8, ~0ULL, ~0ULL},
+      // left diagonal
+      {7, BitBoard::leftDiagonal4ChainMask().to_ullong(),
+       BitBoard::leftDiagonalAdjacencyMask().to_ullong()},
+      // right diagonal
+      {9, BitBoard::rightDiagonal4ChainMask().to_ullong(),
+       BitBoard::rightDiagonalAdjacencyMask().to_ullong()},
+  };
+
+  static GAME_STATE gameState(bool xWin, bool oWin, bool full) {
+    if (xWin)
+      return X_VICTORY;
+    if (oWin)
+      return O_VICTORY;
+    if (full)
+      return TIE;
+    return INCOMPLETE;
+  }
+
+  // empty locations directly above a disk or in the bottom row
+  static unsigned long long playableLocations(unsigned long long occupied) {
+    return ~occupied & ((occupied << 8) | 0xFF);
+  }
+
+  // shifts so that bit i holds the bit that was at i + offset
+  static unsigned long long shift(unsigned long long bits, int offset) {
+    return offset >= 0 ? bits >> offset : bits << -offset;
+  }
+
+  // 1 bit at the start of every 4-in-a-row chain
+  static unsigned long long chainStarts(unsigned long long locations,
+                                        const Direction &direction) {
+    unsigned long long bits = locations;
+    bits &= bits >> direction.shift;
+    bits &= bits >> 2 * direction.shift;
+    return bits & direction.chainMask;
+  }
+
+  // locations that would complete a 4-in-a-row chain if they were added
+  static unsigned long long winningSpots(unsigned long long locations,
+                                         const Direction &direction) {
+    unsigned long long spots = 0;
+    // the new disk is the missing-th location of the chain
+    for (int missing = 0; missing < 4; ++missing) {
+      unsigned long long spot = direction.chainMask
+                                << missing * direction.shift;
+      for (int other = 0; other < 4; ++other)
+        if (other != missing)
+          spot &= shift(locations, (other - missing) * (int)direction.shift);
+      spots |= spot;
+    }
+    return spots;
+  }
+
+  static int adjacencyScore(unsigned long long locations,
+                            const Direction &direction, const int weights[]) {
+    int score = 0;
+    unsigned i = 0;
+    while (locations && i < WEIGHT_LEVELS) {
+      locations &= locations >> direction.shift;
+      locations &= direction.adjacencyMask;
+      score += weights[i] * __builtin_popcountll(locations);
+      ++i;
+    }
+    return score;
+  }
+
+#ifdef BATCHEVALUATOR_AVX2
+  __attribute__((target("avx2"))) static __m256i shiftLeft(__m256i bits,
+                                                           int count) {
+    return _mm256_sll_epi64(bits, _mm_cvtsi32_si128(count));
+  }
+
+  __attribute__((target("avx2"))) static __m256i shiftRight(__m256i bits,
+                                                            int count) {
+    return _mm256_srl_epi64(bits, _mm_cvtsi32_si128(count));
+  }
+
+  __attribute__((target("avx2"))) static __m256i shift(__m256i bits,
+                                                       int offset) {
+    return offset >= 0 ? shiftRight(bits, offset) : shiftLeft(bits, -offset);
+  }
+
+  // 1 bit in the result for each 64-bit lane that isn't 0
+  __attribute__((target("avx2"))) static int nonzeroLanes(__m256i bits) {
+    __m256i zero = _mm256_cmpeq_epi64(bits, _mm256_setzero_si256());
+    return ~_mm256_movemask_pd(_mm256_castsi256_pd(zero)) & 0xF;
+  }
+
+  // number of 1-bits in each 64-bit lane, using a lookup table of nibbles
+  // https://arxiv.org/abs/1611.07612
+  __attribute__((target("avx2"))) static __m256i popcount(__m256i bits) {
+    const __m256i table =
+        _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1,
+                         1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i low = _mm256_and_si256(bits, nibble);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(bits, 4), nibble);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(table, low),
+                                     _mm256_shuffle_epi8(table, high));
+    // sums the 8 byte counts of each lane
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+  }
+
+  __attribute__((target("avx2"))) static __m256i
+  chainStarts(__m256i locations, const Direction &direction) {
+    __m256i bits = locations;
+    bits = _mm256_and_si256(bits, shiftRight(bits, direction.shift));
+    bits = _mm256_and_si256(bits, shiftRight(bits, 2 * direction.shift));
+    return _mm256_and_si256(bits,
+                            _mm256_set1_epi64x(direction.chainMask));
+  }
+
+  __attribute__((target("avx2"))) static __m256i
+  winningSpots(__m256i locations, const Direction &direction) {
+    __m256i spots = _mm256_setzero_si256();
+    for (int missing = 0; missing < 4; ++missing) {
+      __m256i spot = _mm256_set1_epi64x(direction.chainMask
+                                        << missing * direction.shift);
+      for (int other = 0; other < 4; ++other)
+        if (other != missing)
+          spot = _mm256_and_si256(
+              spot,
+              shift(locations, (other - missing) * (int)direction.shift));
+      spots = _mm256_or_si256(spots, spot);
+    }
+    return spots;
+  }
+
+  // keeps iterating until every lane runs out of adjacent bits
+  // weights can be negative, so the multiplication is signed
+  __attribute__((target("avx2"))) static __m256i
+  adjacencyScore(__m256i locations, const Direction &direction,
+                 const int weights[]) {
+    __m256i score = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi64x(direction.adjacencyMask);
+    for (int i = 0; i < WEIGHT_LEVELS && nonzeroLanes(locations); ++i) {
+      locations = _mm256_and_si256(
+          locations, shiftRight(locations, direction.shift));
+      locations = _mm256_and_si256(locations, mask);
+      score = _mm256_add_epi64(
+          score, _mm256_mul_epi32(popcount(locations),
+                                  _mm256_set1_epi64x(weights[i])));
+    }
+    return score;
+  }
+#endif
+};
+
+#endif /* BATCHEVALUATOR_H */
@@ -0,0 +1,598 @@
+// benchmarks for the engine
+// leaf: compares batched leaf evaluation with evaluating one BitBoard at a time
+// search: depth reached per time budget with and without late move reductions
+// selfplay: games between searches with and without late move reductions
+// multipv: exact scores of the best columns compared with searching each
+// column with a full window
+// tt: checks a TranspositionTable shared by many threads for torn entries and
+// searches that disagree with ones without a table
+// async: checks the updates, cancellation, and destruction of AsyncSearcher
+// searches polled from one thread
+// cache: checks that a PositionCache reopened after compactions has exactly
+// the entries stored in it
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "agent.h"
+#include "asyncSearch.h"
+#include "batchEvaluator.h"
+#include "bitBoard.h"
+
+// returns boards reached by playing up to maxMoves random moves from an empty
+// board
+vector<BitBoard> randomBoards(size_t count, unsigned seed = 0,
+                              int maxMoves = 64) {
+  mt19937 random(seed);
+  vector<BitBoard> boards;
+  boards.reserve(count);
+  while (boards.size() < count) {
+    BitBoard board;
+    Disk disk = X;
+    int moves = random() % (maxMoves + 1);
+    for (int i = 0; i < moves && board.getState() == INCOMPLETE; ++i) {
+      int col = random() % 8;
+      if (board.addDisk(disk, col))
+        disk.alternate();
+    }
+    boards.push_back(board);
+  }
+  return boards;
+}
+
+// evaluates a board the way Agent does, one position at a time
+LeafEvaluation evaluateBitBoard(BitBoard board) {
+  LeafEvaluation result;
+  result.state = board.getState();
+  for (Disk disk : {Disk(X), Disk(O)}) {
+    result.adjacency[disk.type] = board.adjacencyScore(disk);
+    for (unsigned char col = 0; col < 8; ++col) {
+      unsigned char row = 0;
+      while (row < 8 && board.getDisk(row, col) != EMPTY)
+        ++row;
+      if (board.addDisk(disk, col)) {
+        if (board.checkWin(board.getLocations(disk)))
+          result.threats[disk.type] |= 1ULL << (8 * row + col);
+        board.popDisk(disk, col);
+      }
+    }
+  }
+  return result;
+}
+
+// threats are only compared for unfinished games, since every move "wins"
+// once a BitBoard already has a 4-in-a-row
+bool matches(const LeafEvaluation &expected, const LeafEvaluation &result) {
+  if (expected.state != result.state ||
+      expected.adjacency[0] != result.adjacency[0] ||
+      expected.adjacency[1] != result.adjacency[1])
+    return false;
+  return expected.state != INCOMPLETE ||
+         (expected.threats[0] == result.threats[0] &&
+          expected.threats[1] == result.threats[1]);
+}
+
+// runs evaluate on every board repeatedly and returns ns per board
+template <typename Evaluate>
+double timePerBoard(const vector<BitBoard> &boards,
+                    vector<LeafEvaluation> &results, Evaluate evaluate,
+                    int repetitions) {
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < repetitions; ++i)
+    evaluate(boards.data(), boards.size(), results.data());
+  auto end = chrono::steady_clock::now();
+  double ns = chrono::duration<double, nano>(end - start).count();
+  return ns / repetitions / boards.size();
+}
+
+bool leafBenchmark() {
+  constexpr size_t BOARDS = 1 << 16;
+  constexpr int REPETITIONS = 20;
+  vector<BitBoard> boards = randomBoards(BOARDS);
+
+  vector<LeafEvaluation> expected(BOARDS), results(BOARDS);
+  double bitBoardTime = timePerBoard(
+      boards, expected,
+      [](const BitBoard *boards, size_t count, LeafEvaluation *results) {
+        for (size_t i = 0; i < count; ++i)
+          results[i] = evaluateBitBoard(boards[i]);
+      },
+      REPETITIONS);
+  cout << "BitBoard: " << bitBoardTime << " ns per board\n";
+
+  auto report = [&](const char *name, double time) {
+    size_t mismatches = 0;
+    for (size_t i = 0; i < BOARDS; ++i)
+      mismatches += !matches(expected[i], results[i]);
+    cout << name << ": " << time << " ns per board, "
+         << bitBoardTime / time << "x BitBoard, " << mismatches
+         << " mismatches\n";
+    return mismatches == 0;
+  };
+
+  bool matched = report(
+      "scalar batch",
+      timePerBoard(
+          boards, results,
+          [](const BitBoard *boards, size_t count, LeafEvaluation *results) {
+            BatchEvaluator::evaluateScalar(boards, count, results);
+          },
+          REPETITIONS));
+#ifdef BATCHEVALUATOR_AVX2
+  if (BatchEvaluator::avx2Supported())
+    matched &= report(
+        "AVX2 batch",
+        timePerBoard(
+            boards, results,
+            [](const BitBoard *boards, size_t count, LeafEvaluation *results) {
+              BatchEvaluator::evaluateAVX2(boards, count, results);
+            },
+            REPETITIONS));
+  else
+    cout << "AVX2 is not supported on this CPU\n";
+#endif
+
+  return matched;
+}
+
+// searches deeper until half of budget is used, since the next depth would
+// usually take longer than all the previous ones
+// returns the deepest completed depth and stores its best column
+int deepestSearch(Agent &agent, double budget, int &bestCol) {
+  auto start = chrono::steady_clock::now();
+  int depth = 0;
+  double elapsed = 0;
+  while (elapsed < budget / 2 && depth < 64) {
+    int scores[8];
+    bestCol = agent.searchColumns(scores, ++depth);
+    elapsed =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }
+  return depth;
+}
+
+void searchBenchmark() {
+  constexpr double BUDGET = 0.5;
+  vector<BitBoard> boards = randomBoards(16, 1, 12);
+  for (bool reductions : {false, true}) {
+    int depths = 0, searches = 0;
+    for (BitBoard board : boards) {
+      if (board.getState() != INCOMPLETE)
+        continue;
+      ++searches;
+      TranspositionTable table(16);
+      Agent agent(&board, board.nextDisk(), &table);
+      agent.setLateMoveReductions(reductions);
+      int bestCol;
+      depths += deepestSearch(agent, BUDGET, bestCol);
+    }
+    cout << (reductions ? "with" : "without")
+         << " late move reductions: average depth " << (double)depths / searches
+         << " in " << BUDGET << " s\n";
+  }
+}
+
+// plays a game from the board between agents that choose columns with
+// chooseColumn, returns the index of the winner, or -1 for a tie
+template <typename ChooseColumn>
+int playGame(BitBoard board, Agent agents[2], ChooseColumn chooseColumn) {
+  for (int turn = 0; board.getState() == INCOMPLETE; ++turn) {
+    Agent &agent = agents[turn % 2];
+    Disk disk = board.nextDisk();
+    agent.setBoardP(&board);
+    agent.setPlayer(disk);
+    int col = chooseColumn(agent);
+    board.addDisk(disk, col);
+    if (board.checkWin(board.getLocations(disk)))
+      return turn % 2;
+  }
+  return -1;
+}
+
+// plays every 2-move opening twice, swapping who moves first
+template <typename ChooseColumn>
+void selfPlay(const string &name, ChooseColumn chooseColumn) {
+  int results[3] = {};
+  for (int opening = 0; opening < 64; ++opening) {
+    BitBoard board;
+    board.addDisk(X, opening / 8);
+    board.addDisk(O, opening % 8);
+    for (int first = 0; first < 2; ++first) {
+      TranspositionTable tables[2]{TranspositionTable(16),
+                                   TranspositionTable(16)};
+      Agent agents[2];
+      for (int i = 0; i < 2; ++i) {
+        agents[i].setTableP(&tables[i]);
+        // the agent at index first is the one with reductions
+        agents[i].setLateMoveReductions(i == first);
+      }
+      int winner = playGame(board, agents, chooseColumn);
+      ++results[winner == -1 ? 2 : winner != first];
+    }
+  }
+  cout << name << ": with late move reductions won " << results[0]
+       << ", lost " << results[1] << ", tied " << results[2] << '\n';
+}
+
+void selfPlayBenchmark() {
+  constexpr int DEPTH = 8;
+  constexpr double BUDGET = 0.03;
+  selfPlay("same depth " + to_string(DEPTH), [](Agent &agent) {
+    int scores[8];
+    return agent.searchColumns(scores, DEPTH);
+  });
+  selfPlay("same time " + to_string(BUDGET) + " s", [](Agent &agent) {
+    int bestCol;
+    deepestSearch(agent, BUDGET, bestCol);
+    return bestCol;
+  });
+}
+
+// exact scores of every column, each searched with a full window
+vector<int> fullWindowScores(Agent &agent, int depth) {
+  vector<int> scores;
+  for (int col = 0; col < 8; ++col) {
+    if (!agent.getBoardP()->validMove(col))
+      continue;
+    int alpha = Agent::DEFAULT_ALPHA;
+    scores.push_back(agent.winsImmediately(col)
+                         ? Agent::DEFAULT_BETA
+                         : agent.evaluatePositionAfterMove(
+                               col, alpha, Agent::DEFAULT_BETA, depth));
+  }
+  sort(scores.rbegin(), scores.rend());
+  return scores;
+}
+
+bool multiPVBenchmark() {
+  constexpr int DEPTH = 9;
+  constexpr int LINES = 3;
+  vector<BitBoard> boards = randomBoards(16, 2, 12);
+  double fullWindowTime = 0, multiPVTime = 0;
+  double tableFullWindowTime = 0, tableMultiPVTime = 0;
+  int mismatches = 0;
+  auto seconds = [](auto start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start)
+        .count();
+  };
+  auto countMismatches = [&](const vector<PrincipalVariation> &variations,
+                             const vector<int> &expected) {
+    for (size_t i = 0; i < variations.size(); ++i)
+      mismatches += variations[i].score != expected[i];
+  };
+  for (BitBoard board : boards) {
+    if (board.getState() != INCOMPLETE)
+      continue;
+    Agent agent(&board, board.nextDisk());
+
+    // fullWindowScores() searches without late move reductions, since they
+    // would make scores depend on the window
+    auto start = chrono::steady_clock::now();
+    vector<int> expected = fullWindowScores(agent, DEPTH);
+    fullWindowTime += seconds(start);
+    // searchPrincipalVariations() has to turn them off itself
+    agent.setLateMoveReductions(true);
+    start = chrono::steady_clock::now();
+    countMismatches(agent.searchPrincipalVariations(LINES, DEPTH), expected);
+    multiPVTime += seconds(start);
+
+    // the same with a new table each time, as analyze.cpp searches
+    {
+      TranspositionTable table(16);
+      agent.setTableP(&table);
+      agent.setLateMoveReductions(false);
+      start = chrono::steady_clock::now();
+      fullWindowScores(agent, DEPTH);
+      tableFullWindowTime += seconds(start);
+    }
+    {
+      TranspositionTable table(16);
+      agent.setTableP(&table);
+      agent.setLateMoveReductions(true);
+      start = chrono::steady_clock::now();
+      countMismatches(agent.searchPrincipalVariations(LINES, DEPTH),
+                      expected);
+      tableMultiPVTime += seconds(start);
+    }
+  }
+  cout << "every column with a full window: " << fullWindowTime << " s, "
+       << tableFullWindowTime << " s with a table\n"
+       << LINES << " best columns: " << multiPVTime << " s, "
+       << tableMultiPVTime << " s with a table, " << mismatches
+       << " scores different from full window ones\n";
+  return mismatches == 0;
+}
+
+// an entry that can be checked against the key it was stored with
+TableEntry entryOf(unsigned long long key) {
+  TableEntry entry;
+  entry.score = (int)(key >> 32);
+  entry.depth = key >> 8;
+  entry.bound = BOUND(1 + key % 3);
+  entry.column = key >> 16 & 7;
+  return entry;
+}
+
+bool matches(const TableEntry &expected, const TableEntry &entry) {
+  return expected.score == entry.score && expected.depth == entry.depth &&
+         expected.bound == entry.bound && expected.column == entry.column;
+}
+
+// returns the number of entries read back with data of another key, from a
+// table of a single bucket that every thread stores to and probes at once
+unsigned long long tornEntries(unsigned threadCount) {
+  constexpr int OPERATIONS = 1 << 20;
+  constexpr int KEYS = 16;
+  // 0 MiB is rounded up to one bucket
+  TranspositionTable table(0);
+  mt19937_64 random(4);
+  vector<unsigned long long> keys(KEYS);
+  for (unsigned long long &key : keys)
+    key = random();
+
+  atomic<unsigned long long> torn{0};
+  vector<thread> threads;
+  for (unsigned t = 0; t < threadCount; ++t)
+    threads.emplace_back([&, t] {
+      mt19937 random(t);
+      unsigned long long threadTorn = 0;
+      for (int i = 0; i < OPERATIONS; ++i) {
+        unsigned long long key = keys[random() % KEYS];
+        table.store(key, entryOf(key));
+        key = keys[random() % KEYS];
+        TableEntry entry;
+        if (table.probe(key, entry))
+          threadTorn += !matches(entryOf(key), entry);
+        // so entries of different ages are replaced too
+        if (t == 0 && i % 4096 == 0)
+          table.newSearch();
+      }
+      torn += threadTorn;
+    });
+  for (thread &t : threads)
+    t.join();
+  return torn;
+}
+
+// returns the number of searches on threads sharing a small table that chose
+// a different column or score than a search without a table
+// every board has the same number of disks and reductions are off, so a
+// position is always searched to the same depth and its scores in the table
+// can't be from a different search than the one without a table
+int sharedTableMismatches(unsigned threadCount) {
+  constexpr int DEPTH = 8;
+  constexpr size_t BOARDS = 8;
+  constexpr int DISKS = 8;
+  mt19937 random(3);
+  vector<BitBoard> boards;
+  while (boards.size() < BOARDS) {
+    BitBoard board;
+    Disk disk = X;
+    while (board.getDisksAdded() < DISKS && board.getState() == INCOMPLETE)
+      if (board.addDisk(disk, random() % 8))
+        disk.alternate();
+    if (board.getState() == INCOMPLETE)
+      boards.push_back(board);
+  }
+
+  vector<int> expectedCols, expectedScores;
+  for (BitBoard board : boards) {
+    Agent agent(&board, board.nextDisk());
+    agent.setLateMoveReductions(false);
+    int scores[8];
+    int col = agent.searchColumns(scores, DEPTH);
+    expectedCols.push_back(col);
+    expectedScores.push_back(scores[col]);
+  }
+
+  TranspositionTable table(1);
+  atomic<int> mismatches{0};
+  vector<thread> threads;
+  for (unsigned t = 0; t < threadCount; ++t)
+    threads.emplace_back([&, t] {
+      // every thread searches every board, starting from a different one
+      for (size_t i = 0; i < BOARDS; ++i) {
+        size_t b = (t + i) % BOARDS;
+        BitBoard board = boards[b];
+        Agent agent(&board, board.nextDisk(), &table);
+        agent.setLateMoveReductions(false);
+        int scores[8];
+        int col = agent.searchColumns(scores, DEPTH);
+        mismatches +=
+            col != expectedCols[b] || scores[col] != expectedScores[b];
+      }
+    });
+  for (thread &t : threads)
+    t.join();
+  return mismatches;
+}
+
+bool sharedTableTest() {
+  unsigned threadCount = max(thread::hardware_concurrency(), 8u);
+  unsigned long long torn = tornEntries(threadCount);
+  cout << threadCount << " threads: " << torn << " torn entries\n";
+  int mismatches = sharedTableMismatches(threadCount);
+  cout << threadCount << " threads: " << mismatches
+       << " searches with a shared table different from ones without\n";
+  return torn == 0 && mismatches == 0;
+}
+
+// returns the seconds taken by f
+template <typename F> double timed(F f) {
+  auto start = chrono::steady_clock::now();
+  f();
+  return chrono::duration<double>(chrono::steady_clock::now() - start)
+      .count();
+}
+
+// searches several games at once from this thread like an event loop, then
+// checks that updates come in increasing depth up to the maximum depth, that
+// cancelled searches finish within CANCEL_BOUND, and that destroying the
+// searcher finishes queued searches
+bool asyncTest() {
+  constexpr size_t GAMES = 8;
+  constexpr int DEPTH = 8;
+  // generous, since cancellation takes tens of microseconds unless the
+  // machine is busy
+  constexpr double CANCEL_BOUND = 0.1;
+  vector<BitBoard> boards;
+  for (BitBoard board : randomBoards(4 * GAMES, 5, 12))
+    if (boards.size() < GAMES && board.getState() == INCOMPLETE)
+      boards.push_back(board);
+
+  bool passed = true;
+  auto check = [&](bool condition, const string &failure) {
+    if (!condition)
+      cout << failure << '\n';
+    passed &= condition;
+  };
+
+  TranspositionTable table(16);
+  {
+    AsyncSearcher searcher(2, &table);
+    atomic<int> callbacks{0};
+    vector<SearchHandle> handles;
+    for (const BitBoard &board : boards)
+      handles.push_back(searcher.search(
+          board, board.nextDisk(), DEPTH,
+          [&](const SearchUpdate &) { ++callbacks; }));
+
+    vector<int> lastDepths(GAMES, -1);
+    int updates = 0;
+    for (bool running = true; running;) {
+      running = false;
+      for (size_t i = 0; i < GAMES; ++i) {
+        // finished is read first, so no updates are left after it
+        running |= !handles[i].finished();
+        SearchUpdate update;
+        while (handles[i].poll(update)) {
+          ++updates;
+          check(update.depth > lastDepths[i] && lastDepths[i] != 0,
+                "game " + to_string(i) + ": depth " + to_string(update.depth) +
+                    " after " + to_string(lastDepths[i]));
+          check(boards[i].validMove(update.column),
+                "game " + to_string(i) + ": invalid column " +
+                    to_string(update.column));
+          lastDepths[i] = update.depth;
+        }
+      }
+      this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    for (size_t i = 0; i < GAMES; ++i)
+      check(lastDepths[i] == 0 || lastDepths[i] == DEPTH,
+            "game " + to_string(i) + ": last depth " +
+                to_string(lastDepths[i]));
+    check(callbacks == updates, to_string(callbacks) + " callbacks for " +
+                                    to_string(updates) + " updates");
+    cout << GAMES << " games polled from one thread: " << updates
+         << " updates\n";
+
+    // searches of the empty board that would take far too long to finish
+    double worstCancel = 0;
+    for (int i = 0; i < 4; ++i) {
+      SearchHandle handle = searcher.search(BitBoard(), X, 64);
+      this_thread::sleep_for(chrono::milliseconds(20 + 10 * i));
+      worstCancel = max(worstCancel, timed([&] {
+                          handle.cancel();
+                          handle.wait();
+                        }));
+    }
+    check(worstCancel < CANCEL_BOUND, "cancelling took too long");
+    cout << "slowest cancel and wait: " << worstCancel * 1e6 << " us\n";
+  }
+
+  // one thread, so all but one search are still queued
+  vector<SearchHandle> queued;
+  double destruction = timed([&] {
+    AsyncSearcher searcher(1, &table);
+    for (int i = 0; i < 16; ++i)
+      queued.push_back(searcher.search(BitBoard(), X, 64));
+    this_thread::sleep_for(chrono::milliseconds(10));
+  });
+  int unfinished = 0;
+  for (const SearchHandle &handle : queued)
+    unfinished += !handle.finished();
+  check(unfinished == 0, to_string(unfinished) +
+                             " searches unfinished after destruction");
+  // the 10 ms sleep is part of it
+  check(destruction < 0.01 + CANCEL_BOUND, "destruction took too long");
+  cout << "destroyed with " << queued.size() << " searches in "
+       << destruction * 1e3 << " ms, " << unfinished << " unfinished\n";
+  return passed;
+}
+
+// stores entries in a new cache, compacts it, and stores more, twice, checking
+// that reopening it finds every entry and nothing else each time
+bool cacheTest() {
+  constexpr int BEFORE = 1000;
+  constexpr int AFTER = 10;
+  constexpr unsigned long long FINGERPRINT = 1;
+  string path =
+      (filesystem::temp_directory_path() / "benchPositionCache").string();
+  for (const char *extension : {".idx", ".log"})
+    filesystem::remove(path + extension);
+
+  auto keyOf = [](int i) { return BitBoard::key(i, 0); };
+  int stored = 0;
+  auto storeMore = [&](PositionCache &cache, int count) {
+    for (int end = stored + count; stored < end; ++stored) {
+      TableEntry entry;
+      entry.score = stored;
+      entry.depth = cache.getMinDepth();
+      entry.bound = EXACT_BOUND;
+      cache.store(keyOf(stored), entry);
+    }
+  };
+
+  bool passed = true;
+  for (int round = 1; round <= 2; ++round) {
+    {
+      // the first round creates the log, and the second appends to it
+      PositionCache cache(path, FINGERPRINT);
+      storeMore(cache, BEFORE);
+      passed &= cache.compact();
+      storeMore(cache, AFTER);
+      cache.flush();
+    }
+    PositionCache cache(path, FINGERPRINT);
+    int missing = 0;
+    for (int i = 0; i < stored; ++i) {
+      TableEntry entry;
+      missing += !cache.probe(keyOf(i), entry) || entry.score != i;
+    }
+    TableEntry entry;
+    bool extra = cache.size() != (size_t)stored || cache.probe(0, entry);
+    cout << "reopened after compaction " << round << ": " << cache.size()
+         << " positions of " << stored << ", " << missing << " missing"
+         << (extra ? ", and some that weren't stored" : "") << '\n';
+    passed &= missing == 0 && !extra;
+  }
+  for (const char *extension : {".idx", ".log"})
+    filesystem::remove(path + extension);
+  return passed;
+}
+
+int main(int argc, char *argv[]) {
+  string benchmark = argc > 1 ? argv[1] : "all";
+  bool passed = true;
+  if (benchmark == "leaf" || benchmark == "all")
+    passed = leafBenchmark();
+  if (benchmark == "search" || benchmark == "all")
+    searchBenchmark();
+  if (benchmark == "selfplay" || benchmark == "all")
+    selfPlayBenchmark();
+  if (benchmark == "multipv" || benchmark == "all")
+    passed &= multiPVBenchmark();
+  if (benchmark == "tt" || benchmark == "all")
+    passed &= sharedTableTest();
+  if (benchmark == "async" || benchmark == "all")
+    passed &= asyncTest();
+  if (benchmark == "cache" || benchmark == "all")
+    passed &= cacheTest();
+  return passed ? 0 : 1;
+}
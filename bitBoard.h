@@ -2,10 +2,12 @@
 #define BITBOARD_H
 
 #include <bitset>
+#include <functional>
 #include <sstream>
 #include <string>
 #include "disk.h"
 #include "board.h"
+#include "evalWeights.h"
 using namespace std;
 
 // class to save time checking for win/loss by using bitsets
@@ -35,6 +37,9 @@ public:
     rightBits &= rightBits >> 9;
     // if two diagonals above is 1, then there's a diagonal of 4
     rightBits &= rightBits >> 18;
+    // shifts also wrap around to the next row, so only chains starting where
+    // there's room for them count
+    rightBits &= rightDiagonal4ChainMask();
     if (rightBits.any())
       return true;
 
@@ -42,6 +47,7 @@ public:
     // left diagonals are spaced 7 apart
     leftBits &= leftBits >> 7;
     leftBits &= leftBits >> 14;
+    leftBits &= leftDiagonal4ChainMask();
     return leftBits.any();
   }
 
@@ -65,6 +71,18 @@ public:
     return rowMask(0b11100000);
   }
 
+  // mask to exclude locations that cannot have a right diagonal 4-in-a-row,
+  // which goes right as it goes up, like a horizontal one
+  static constexpr bitset<64> rightDiagonal4ChainMask() {
+    return horizontal4ChainMask();
+  }
+
+  // mask to exclude locations that cannot have a left diagonal 4-in-a-row
+  static constexpr bitset<64> leftDiagonal4ChainMask() {
+    // every column from 2 on down can't have a left diagonal chain
+    return rowMask(0b00000111);
+  }
+
   // check if there's any 4-in-a-row horizontally
   bool checkHorizontal(const bitset<64> &locations) const {
     bitset<64> horizontalBits = locations;
@@ -175,6 +193,22 @@ public:
       added += columnHeights[i];
     return added;
   }
+  // returns the disk of the player whose turn it is, since X always moves
+  // first
+  Disk nextDisk() const { return getDisksAdded() % 2 ? O : X; }
+  // adds disks for the players in turn to the columns in moves, a string of
+  // columns from 1 to 8 like main.cpp's inputs
+  // returns the number of moves added, which is less than moves.size() if
+  // one of them was invalid
+  size_t addMoves(const string &moves) {
+    size_t added = 0;
+    for (char c : moves) {
+      if (c < '1' || c > '8' || !addDisk(nextDisk(), c - '1'))
+        break;
+      ++added;
+    }
+    return added;
+  }
 
   bool hasDisk(const bitset<64> &locations, unsigned char row,
                unsigned char col) const {
@@ -191,13 +225,18 @@ public:
   }
 
   // returns a score based on number of adjacent 1-bits
-  unsigned adjacencyScore(Disk disk, unsigned shift) const {
-    unsigned score = 0;
-    unsigned i = 1;
+  // weights[i] is added for each group of i + 2 adjacent 1-bits
+  // only locations in mask stay adjacent after shifting, so that shifts
+  // wrapping around to the next row don't count
+  int adjacencyScore(Disk disk, unsigned shift, const int weights[],
+                     const bitset<64> &mask = bitset<64>().set()) const {
+    int score = 0;
+    unsigned i = 0;
     bitset<64> locations = getLocations(disk);
-    while (locations.any()) {
+    while (locations.any() && i < WEIGHT_LEVELS) {
       locations &= locations >> shift;
-      score += i * locations.count();
+      locations &= mask;
+      score += weights[i] * (int)locations.count();
       ++i;
     }
     return score;
@@ -206,17 +245,24 @@ public:
   static constexpr bitset<64> horizontalAdjacencyMask() {
     return rowMask(1 << 7);
   }
+  // a left diagonal goes left as it goes up, so the first column wraps
+  static constexpr bitset<64> leftDiagonalAdjacencyMask() {
+    return rowMask(1);
+  }
+  static constexpr bitset<64> rightDiagonalAdjacencyMask() {
+    return horizontalAdjacencyMask();
+  }
 
   // score for horizontal adjacents that excludes cross-row adjacency
   // the specialization doesn't seem to be necessary
-  unsigned horizontalAdjacencyScore(Disk disk) const {
-    unsigned score = 0;
-    unsigned i = 1;
+  int horizontalAdjacencyScore(Disk disk, const int weights[]) const {
+    int score = 0;
+    unsigned i = 0;
     bitset<64> locations = getLocations(disk);
-    while (locations.any()) {
+    while (locations.any() && i < WEIGHT_LEVELS) {
       locations &= locations >> 1;
       locations &= horizontalAdjacencyMask();
-      score += i * locations.count();
+      score += weights[i] * (int)locations.count();
       ++i;
     }
     return score;
@@ -224,19 +270,51 @@ public:
 
   // returns a score based on number of adjacent 1-bits
   // for position scoring heuristic
-  unsigned adjacencyScore(Disk disk) const {
-    unsigned score = 0;
+  int adjacencyScore(Disk disk,
+                     const EvalWeights &weights = EVAL_WEIGHTS) const {
+    int score = 0;
     // horizontal adjacents
-    score += horizontalAdjacencyScore(disk); // adjacencyScore(disk, 1);
+    score += horizontalAdjacencyScore(disk, weights.adjacency[0]);
     // vertical adjacents
-    score += adjacencyScore(disk, 8);
+    score += adjacencyScore(disk, 8, weights.adjacency[1]);
     // left diagonal adjacents
-    score += adjacencyScore(disk, 7);
+    score += adjacencyScore(disk, 7, weights.adjacency[2],
+                            leftDiagonalAdjacencyMask());
     // right diagonal adjacents
-    score += adjacencyScore(disk, 9);
+    score += adjacencyScore(disk, 9, weights.adjacency[3],
+                            rightDiagonalAdjacencyMask());
     return score;
   }
 
+  // returns a hash of the disk locations for the transposition table
+  unsigned long long key() const {
+    return key(getXLocations().to_ullong(), getOLocations().to_ullong());
+  }
+
+  // returns key() of the board after the disk is added to the column
+  // without modifying this board, assuming it's a valid move
+  unsigned long long keyAfter(Disk disk, unsigned char col) const {
+    unsigned long long locations[2] = {getXLocations().to_ullong(),
+                                       getOLocations().to_ullong()};
+    locations[disk.type] |= 1ULL << (8 * columnHeights[col] + col);
+    return key(locations[0], locations[1]);
+  }
+
+  // combines the X and O locations using MurmurHash3's 64-bit finalizer
+  // https://github.com/aappleby/smhasher/wiki/MurmurHash3
+  static unsigned long long key(unsigned long long xLocations,
+                                unsigned long long oLocations) {
+    auto mix = [](unsigned long long bits) {
+      bits ^= bits >> 33;
+      bits *= 0xff51afd7ed558ccdULL;
+      bits ^= bits >> 33;
+      bits *= 0xc4ceb9fe1a85ec53ULL;
+      bits ^= bits >> 33;
+      return bits;
+    };
+    return mix(xLocations) ^ mix(oLocations + 0x9e3779b97f4a7c15ULL);
+  }
+
   operator Board<8, 8>() const {
     Board<8, 8> board;
     for (int col = 0; col < 8; ++col) {
@@ -261,7 +339,12 @@ private:
   // height of each column in disks
   unsigned char columnHeights[8] = {};
 
-  friend class std::hash<BitBoard>;
+  friend struct std::hash<BitBoard>;
+};
+
+// allows BitBoards as keys of unordered containers
+template <> struct std::hash<BitBoard> {
+  size_t operator()(const BitBoard &board) const { return board.key(); }
 };
 
 #endif /* BITBOARD_H */
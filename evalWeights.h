@@ -0,0 +1,25 @@
+#ifndef EVALWEIGHTS_H
+#define EVALWEIGHTS_H
+
+// weights of the position scoring heuristic in BitBoard::adjacencyScore()
+// this file is rewritten by tune.cpp, see README.md
+
+// directions in the order horizontal, vertical, left diagonal, right diagonal
+constexpr int WEIGHT_DIRECTIONS = 4;
+// most times adjacent disks can be counted in a direction, since a row,
+// column, or diagonal has at most 8 disks
+constexpr int WEIGHT_LEVELS = 7;
+
+struct EvalWeights {
+  // adjacency[direction][i] is added for each group of i + 2 disks in a row
+  int adjacency[WEIGHT_DIRECTIONS][WEIGHT_LEVELS];
+};
+
+constexpr EvalWeights EVAL_WEIGHTS = {{
+    {1, 2, 3, 4, 5, 6, 7},
+    {1, 2, 3, 4, 5, 6, 7},
+    {1, 2, 3, 4, 5, 6, 7},
+    {1, 2, 3, 4, 5, 6, 7},
+}};
+
+#endif /* EVALWEIGHTS_H */
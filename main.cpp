@@ -1,4 +1,5 @@
 // Xingzhe Li, Daniel Roche, Jianqi Shi, Ching-Heng Hsiao
+#include <cstdlib>
 #include <fstream>
 #include <queue>
 
@@ -6,7 +7,16 @@
 #include "board.h"
 #include "timedAgent.h"
 
-int main() {
+// size of the transposition table in MiB if it isn't the first argument
+constexpr size_t DEFAULT_TABLE_MEGABYTES = 64;
+// files of the positions searched in previous runs, without extensions
+const char *POSITION_CACHE_PATH = "positionCache";
+
+int main(int argc, char *argv[]) {
+  size_t tableMegabytes =
+      argc > 1 ? strtoull(argv[1], nullptr, 10) : DEFAULT_TABLE_MEGABYTES;
+  TranspositionTable table(tableMegabytes, true);
+
   cout << "welcome to four-in-row game!" << endl;
   Board board;
   queue<int> inputs;
@@ -18,6 +28,9 @@ int main() {
   cout << "You've selected to play as " << diskSelection << ". Begin!" << endl;
 
   TimedAgent opponent;
+  opponent.setTableP(&table);
+  PositionCache cache(POSITION_CACHE_PATH, opponent.searchFingerprint());
+  opponent.setCacheP(&cache);
   while (cin) {
     int columnChoice = 8;
     // if it's the player's turn
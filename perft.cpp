@@ -0,0 +1,238 @@
+// counts the positions reachable by adding disks, to check the BitBoard
+// against the original Board and measure how fast disks are added and removed
+// https://www.chessprogramming.org/Perft
+//
+// ./perft <depth> [moves] [threads]
+//   counts leaves depth moves after the position reached by moves, a string
+//   of columns from 1 to 8 like main.cpp's inputs, using threads threads
+// ./perft verify
+//   checks the counts from the empty board against known counts, and checks
+//   that BitBoard agrees with Board after every move from random positions
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bitBoard.h"
+#include "board.h"
+#include "disk.h"
+
+// leaves depth moves ahead, where a game that ends sooner is also a leaf
+struct PerftCounts {
+  unsigned long long leaves = 0;
+  unsigned long long xVictories = 0;
+  unsigned long long oVictories = 0;
+  unsigned long long ties = 0;
+  // number of times a disk was added and then removed
+  unsigned long long moves = 0;
+
+  PerftCounts &operator+=(const PerftCounts &other) {
+    leaves += other.leaves;
+    xVictories += other.xVictories;
+    oVictories += other.oVictories;
+    ties += other.ties;
+    moves += other.moves;
+    return *this;
+  }
+
+  bool operator==(const PerftCounts &other) const {
+    return leaves == other.leaves && xVictories == other.xVictories &&
+           oVictories == other.oVictories && ties == other.ties;
+  }
+};
+
+// counts a position after a move, returning whether the game ended there
+bool countEnded(GAME_STATE state, PerftCounts &counts) {
+  switch (state) {
+  case X_VICTORY:
+    ++counts.xVictories;
+    break;
+  case O_VICTORY:
+    ++counts.oVictories;
+    break;
+  case TIE:
+    ++counts.ties;
+    break;
+  case INCOMPLETE:
+    return false;
+  }
+  ++counts.leaves;
+  return true;
+}
+
+// counts leaves depth moves after the board, where disk moves next
+void perft(BitBoard &board, Disk disk, int depth, PerftCounts &counts) {
+  if (depth == 0) {
+    ++counts.leaves;
+    return;
+  }
+  for (unsigned char col = 0; col < 8; ++col) {
+    if (!board.validMove(col))
+      continue;
+    board.addDisk(disk, col);
+    ++counts.moves;
+    if (!countEnded(board.getState(), counts))
+      perft(board, disk.counterpart(), depth - 1, counts);
+    board.popDisk(disk, col);
+  }
+}
+
+// counts the first 2 moves, then splits the positions after them between
+// threads, which take them in turn
+PerftCounts parallelPerft(BitBoard board, Disk disk, int depth,
+                          unsigned threadCount) {
+  PerftCounts counts;
+  if (depth < 3 || threadCount <= 1) {
+    perft(board, disk, depth, counts);
+    return counts;
+  }
+
+  vector<BitBoard> tasks;
+  Disk second = disk.counterpart();
+  for (unsigned char first = 0; first < 8; ++first) {
+    if (!board.addDisk(disk, first))
+      continue;
+    ++counts.moves;
+    if (!countEnded(board.getState(), counts)) {
+      for (unsigned char col = 0; col < 8; ++col) {
+        if (!board.addDisk(second, col))
+          continue;
+        ++counts.moves;
+        if (!countEnded(board.getState(), counts))
+          tasks.push_back(board);
+        board.popDisk(second, col);
+      }
+    }
+    board.popDisk(disk, first);
+  }
+
+  atomic<size_t> nextTask{0};
+  vector<PerftCounts> threadCounts(threadCount);
+  vector<thread> threads;
+  for (unsigned t = 0; t < threadCount; ++t)
+    threads.emplace_back([&, t] {
+      for (size_t i; (i = nextTask++) < tasks.size();)
+        perft(tasks[i], disk, depth - 2, threadCounts[t]);
+    });
+  for (thread &t : threads)
+    t.join();
+  for (const PerftCounts &c : threadCounts)
+    counts += c;
+  return counts;
+}
+
+// checks that BitBoard and Board agree on every position up to depth moves
+// after the board, where disk moves next, returning the number of positions
+// they disagree on
+unsigned long long compareBoards(BitBoard &bitBoard, Board<8, 8> &board,
+                                 Disk disk, int depth) {
+  unsigned long long mismatches = 0;
+  for (int row = 0; row < 8; ++row)
+    for (int col = 0; col < 8; ++col)
+      mismatches += bitBoard.getDisk(row, col) != board.getDisk(row, col);
+  if (bitBoard.getState() != board.getState()) {
+    ++mismatches;
+    cout << "BitBoard state " << bitBoard.getState() << ", Board state "
+         << board.getState() << '\n';
+    board.display();
+  }
+  if (mismatches || depth == 0 || board.getState() != INCOMPLETE)
+    return mismatches;
+  for (unsigned char col = 0; col < 8; ++col) {
+    if (bitBoard.validMove(col) != board.validMove(col))
+      ++mismatches;
+    if (!board.validMove(col))
+      continue;
+    bitBoard.addDisk(disk, col);
+    board.addDisk(disk, col);
+    mismatches += compareBoards(bitBoard, board, disk.counterpart(), depth - 1);
+    bitBoard.popDisk(disk, col);
+    board.popDisk(col);
+  }
+  return mismatches;
+}
+
+// counts from the empty board, counted with Board
+const PerftCounts REFERENCE_COUNTS[] = {
+    {1, 0, 0, 0},
+    {8, 0, 0, 0},
+    {64, 0, 0, 0},
+    {512, 0, 0, 0},
+    {4096, 0, 0, 0},
+    {32768, 0, 0, 0},
+    {262144, 0, 0, 0},
+    {2097152, 27944, 0, 0},
+    {16581608, 27944, 120464, 0},
+    {131614000, 3336936, 120464, 0},
+};
+
+int verify() {
+  bool passed = true;
+  unsigned threadCount = max(thread::hardware_concurrency(), 1u);
+  for (int depth = 0; depth < 10; ++depth) {
+    PerftCounts counts = parallelPerft(BitBoard(), X, depth, threadCount);
+    bool matched = counts == REFERENCE_COUNTS[depth];
+    passed &= matched;
+    cout << "depth " << depth << ": " << counts.leaves << " leaves "
+         << (matched ? "match" : "DON'T MATCH") << '\n';
+  }
+
+  // random positions, so that disks are near every edge
+  mt19937 random(0);
+  unsigned long long mismatches = 0;
+  for (int i = 0; i < 200; ++i) {
+    BitBoard bitBoard;
+    Board<8, 8> board;
+    Disk disk = X;
+    int moves = 20 + random() % 30;
+    for (int move = 0; move < moves && board.getState() == INCOMPLETE;
+         ++move) {
+      int col = random() % 8;
+      if (board.addDisk(disk, col)) {
+        bitBoard.addDisk(disk, col);
+        disk.alternate();
+      }
+    }
+    if (board.getState() == INCOMPLETE)
+      mismatches += compareBoards(bitBoard, board, disk, 4);
+  }
+  cout << mismatches << " positions where BitBoard and Board disagree\n";
+  passed &= mismatches == 0;
+  return passed ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    cout << "usage: " << argv[0] << " <depth> [moves] [threads]\n"
+         << "       " << argv[0] << " verify\n";
+    return 1;
+  }
+  if (string(argv[1]) == "verify")
+    return verify();
+
+  int depth = stoi(argv[1]);
+  BitBoard board;
+  string moves = argc >= 3 ? argv[2] : "";
+  size_t added = board.addMoves(moves);
+  if (added < moves.size()) {
+    cout << "invalid move: " << moves[added] << '\n';
+    return 1;
+  }
+  Disk disk = board.nextDisk();
+  unsigned threadCount = argc >= 4 ? stoi(argv[3]) : 1;
+
+  auto start = chrono::steady_clock::now();
+  PerftCounts counts = parallelPerft(board, disk, depth, threadCount);
+  double seconds =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  cout << "leaves: " << counts.leaves << '\n'
+       << "X victories: " << counts.xVictories << '\n'
+       << "O victories: " << counts.oVictories << '\n'
+       << "ties: " << counts.ties << '\n'
+       << "moves: " << counts.moves << " in " << seconds << " s, "
+       << counts.moves / seconds << " added and removed per second\n";
+  return 0;
+}
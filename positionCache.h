@@ -0,0 +1,435 @@
+#ifndef POSITIONCACHE_H
+#define POSITIONCACHE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#define POSITIONCACHE_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "transpositionTable.h"
+using namespace std;
+
+// deep search results kept on disk between runs, consulted by Agent like a
+// second, slower transposition table
+//
+// results are appended to <path>.log, and compaction merges them into
+// <path>.idx, a hash table that is memory-mapped instead of read on startup
+// where mmap is available
+// a background thread flushes and compacts periodically
+//
+// both files start with the fingerprint of the search that made the results,
+// see Agent::searchFingerprint(), and are thrown away if it's different
+class PositionCache {
+public:
+  // default minimum requiredDepth of stored results
+  static constexpr int DEFAULT_MIN_DEPTH = 6;
+
+  // opens or creates the cache files at path for results of searches with
+  // the fingerprint
+  PositionCache(const string &path, unsigned long long fingerprint,
+                int minDepth = DEFAULT_MIN_DEPTH,
+                chrono::milliseconds flushInterval = chrono::seconds(5))
+      : path(path), fingerprint(fingerprint), minDepth(minDepth) {
+    loadIndex(path + ".idx", fingerprint, index);
+    openLog();
+    flusher = thread(
+        [this, flushInterval] { flushPeriodically(flushInterval); });
+  }
+  PositionCache(const PositionCache &) = delete;
+  PositionCache &operator=(const PositionCache &) = delete;
+
+  // stops the background thread and flushes everything stored
+  ~PositionCache() {
+    {
+      lock_guard<mutex> lock(flusherLock);
+      exiting = true;
+    }
+    flusherCondition.notify_one();
+    flusher.join();
+    flush();
+    if (log)
+      fclose(log);
+    unloadIndex(index);
+  }
+
+  // results searched shallower than this aren't worth a disk lookup
+  int getMinDepth() const { return minDepth; }
+  // fingerprint of the searches whose results are stored
+  unsigned long long getFingerprint() const { return fingerprint; }
+
+  // returns whether the key was found, copying its entry if it was
+  bool probe(unsigned long long key, TableEntry &entry) const {
+    shared_lock<shared_mutex> lock(entriesLock);
+    for (const auto *entries : {&recent, &merging}) {
+      auto found = entries->find(key);
+      if (found != entries->end()) {
+        entry = TableEntry::unpack(found->second);
+        return true;
+      }
+    }
+    const IndexSlot *slot = findSlot(index, key);
+    if (!slot || slot->data == 0)
+      return false;
+    entry = TableEntry::unpack(slot->data);
+    return true;
+  }
+
+  // stores the entry if it was searched deep enough and is no shallower than
+  // what's already stored, writing it to disk on the next flush
+  void store(unsigned long long key, TableEntry entry) {
+    if (entry.depth < minDepth)
+      return;
+    // ages only make sense within one TranspositionTable
+    entry.age = 0;
+    TableEntry stored;
+    if (probe(key, stored) && stored.depth > entry.depth)
+      return;
+    unsigned long long data = entry.pack();
+    unique_lock<shared_mutex> lock(entriesLock);
+    recent[key] = data;
+    pending.push_back({key, data});
+  }
+
+  // appends stored entries to the log
+  void flush() {
+    vector<IndexSlot> records;
+    {
+      unique_lock<shared_mutex> lock(entriesLock);
+      records.swap(pending);
+    }
+    lock_guard<mutex> lock(logLock);
+    appendToLog(records);
+  }
+
+  // merges the log into a new index and empties the log, returning whether
+  // it succeeded
+  // a crash or error part way leaves either the old index and the whole log,
+  // or the new index and a log that's already merged into it
+  // searches only wait for the new index to replace the old one, not for it
+  // to be written
+  bool compact() {
+    lock_guard<mutex> compactGuard(compactLock);
+    lock_guard<mutex> logGuard(logLock);
+    // entries stored from now on go into an empty recent
+    vector<IndexSlot> records;
+    {
+      unique_lock<shared_mutex> lock(entriesLock);
+      records.swap(pending);
+      merging.swap(recent);
+    }
+    // so the log has every entry being merged
+    if (!appendToLog(records)) {
+      unmerge();
+      return false;
+    }
+
+    // entries of the old index, overwritten by merging ones
+    // only compaction changes index and merging, so they can be read unlocked
+    unordered_map<unsigned long long, unsigned long long> merged;
+    for (size_t i = 0; i < index.slotCount; ++i)
+      if (index.slots[i].data)
+        merged[index.slots[i].key] = index.slots[i].data;
+    for (const auto &entry : merging)
+      merged[entry.first] = entry.second;
+
+    // at most half full so probes stay short
+    size_t newSlotCount = 1024;
+    while (newSlotCount < 2 * merged.size())
+      newSlotCount *= 2;
+    vector<IndexSlot> newSlots(newSlotCount);
+    for (const auto &entry : merged) {
+      size_t i = slotOf(entry.first, newSlotCount);
+      while (newSlots[i].data)
+        i = (i + 1) % newSlotCount;
+      newSlots[i] = {entry.first, entry.second};
+    }
+
+    string indexPath = path + ".idx";
+    string temporary = indexPath + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    bool written = file != nullptr;
+    if (file) {
+      IndexHeader header{INDEX_MAGIC, fingerprint, newSlotCount};
+      written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                fwrite(newSlots.data(), sizeof(IndexSlot), newSlotCount,
+                       file) == newSlotCount &&
+                sync(file);
+      written &= fclose(file) == 0;
+    }
+    error_code error;
+    if (written)
+      filesystem::rename(temporary, indexPath, error);
+    Index newIndex;
+    if (!written || error || !loadIndex(indexPath, fingerprint, newIndex)) {
+      filesystem::remove(temporary, error);
+      unmerge();
+      return false;
+    }
+
+    // the new index has every entry of the log now, so if emptying it fails,
+    // its entries are only merged again
+    filesystem::resize_file(path + ".log", sizeof(LogHeader), error);
+    if (!error)
+      logRecords = 0;
+    Index oldIndex = index;
+    merged.clear();
+    {
+      unique_lock<shared_mutex> lock(entriesLock);
+      index = newIndex;
+      merged.swap(merging);
+    }
+    // freed after unlocking, since it can take a while
+    merged.clear();
+    unloadIndex(oldIndex);
+    return true;
+  }
+
+  // number of positions stored
+  size_t size() const {
+    shared_lock<shared_mutex> lock(entriesLock);
+    size_t count = 0;
+    for (size_t i = 0; i < index.slotCount; ++i)
+      count += index.slots[i].data != 0;
+    for (const auto *entries : {&recent, &merging})
+      for (const auto &entry : *entries) {
+        const IndexSlot *slot = findSlot(index, entry.first);
+        count += (!slot || slot->data == 0) &&
+                 (entries == &recent || !recent.count(entry.first));
+      }
+    return count;
+  }
+
+private:
+  // a record of the log, or a slot of the index where data 0 is empty
+  struct IndexSlot {
+    unsigned long long key = 0;
+    // packed TableEntry
+    unsigned long long data = 0;
+  };
+  struct IndexHeader {
+    unsigned long long magic;
+    unsigned long long fingerprint;
+    unsigned long long slotCount;
+  };
+  struct LogHeader {
+    unsigned long long magic;
+    unsigned long long fingerprint;
+  };
+  // "4INAROW" and a version number
+  static constexpr unsigned long long INDEX_MAGIC = 0x02574f52414e4934ULL;
+  // "4INAROL" and a version number
+  static constexpr unsigned long long LOG_MAGIC = 0x024c4f52414e4934ULL;
+
+  // an index file loaded into memory
+  struct Index {
+    void *memory = nullptr;
+    size_t bytes = 0;
+    const IndexSlot *slots = nullptr;
+    size_t slotCount = 0;
+  };
+
+  static size_t slotOf(unsigned long long key, size_t slotCount) {
+    return (unsigned __int128)key * slotCount >> 64;
+  }
+
+  // returns the slot with the key, or the empty slot where it would be, or
+  // nullptr if there's no index
+  static const IndexSlot *findSlot(const Index &index,
+                                   unsigned long long key) {
+    if (index.slotCount == 0)
+      return nullptr;
+    size_t i = slotOf(key, index.slotCount);
+    while (index.slots[i].data && index.slots[i].key != key)
+      i = (i + 1) % index.slotCount;
+    return &index.slots[i];
+  }
+
+  // flushes the file's buffer and waits for it to reach the disk
+  static bool sync(FILE *file) {
+    if (fflush(file) != 0)
+      return false;
+#ifdef POSITIONCACHE_POSIX
+    return fsync(fileno(file)) == 0;
+#else
+    return true;
+#endif
+  }
+
+  // loads the index file into index, returning whether it exists and has
+  // the fingerprint
+  static bool loadIndex(const string &file, unsigned long long fingerprint,
+                        Index &index) {
+    error_code error;
+    size_t bytes = filesystem::file_size(file, error);
+    if (error || bytes < sizeof(IndexHeader))
+      return false;
+#ifdef POSITIONCACHE_POSIX
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd == -1)
+      return false;
+    void *memory = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+      return false;
+#else
+    void *memory = ::operator new(bytes);
+    FILE *in = fopen(file.c_str(), "rb");
+    bool read = in && fread(memory, 1, bytes, in) == bytes;
+    if (in)
+      fclose(in);
+    if (!read) {
+      ::operator delete(memory);
+      return false;
+    }
+#endif
+    Index loaded{memory, bytes};
+    const IndexHeader *header = static_cast<const IndexHeader *>(memory);
+    if (header->magic != INDEX_MAGIC || header->fingerprint != fingerprint ||
+        header->slotCount == 0 ||
+        bytes != sizeof(IndexHeader) + header->slotCount * sizeof(IndexSlot)) {
+      unloadIndex(loaded);
+      return false;
+    }
+    loaded.slots = reinterpret_cast<const IndexSlot *>(header + 1);
+    loaded.slotCount = header->slotCount;
+    index = loaded;
+    return true;
+  }
+
+  static void unloadIndex(Index &index) {
+    if (index.memory) {
+#ifdef POSITIONCACHE_POSIX
+      munmap(index.memory, index.bytes);
+#else
+      ::operator delete(index.memory);
+#endif
+    }
+    index = Index();
+  }
+
+  // loads records written since the last compaction, ignoring a partial
+  // record at the end from a crash during a flush, and opens the log for
+  // appending
+  // a log without the fingerprint is replaced by an empty one
+  void openLog() {
+    string logPath = path + ".log";
+    bool valid = false;
+    if (FILE *in = fopen(logPath.c_str(), "rb")) {
+      LogHeader header;
+      valid = fread(&header, sizeof(header), 1, in) == 1 &&
+              header.magic == LOG_MAGIC && header.fingerprint == fingerprint;
+      IndexSlot record;
+      while (valid && fread(&record, sizeof(record), 1, in) == 1) {
+        recent[record.key] = record.data;
+        ++logRecords;
+      }
+      fclose(in);
+    }
+
+    if (valid) {
+      // so that new records are appended at a record boundary
+      error_code error;
+      filesystem::resize_file(
+          logPath, sizeof(LogHeader) + logRecords * sizeof(IndexSlot), error);
+      log = fopen(logPath.c_str(), "ab");
+      return;
+    }
+    FILE *file = fopen(logPath.c_str(), "wb");
+    if (!file)
+      return;
+    LogHeader header{LOG_MAGIC, fingerprint};
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && sync(file);
+    written &= fclose(file) == 0;
+    // in append mode, so writes still go to the end after compact() empties
+    // the log
+    if (written)
+      log = fopen(logPath.c_str(), "ab");
+  }
+
+  // puts entries being merged back into recent after a failed compaction,
+  // keeping newer ones stored during it
+  void unmerge() {
+    unique_lock<shared_mutex> lock(entriesLock);
+    for (const auto &entry : recent)
+      merging[entry.first] = entry.second;
+    recent.swap(merging);
+    merging.clear();
+  }
+
+  // appends the records to the log, returning whether they were all written
+  // must be called with logLock held
+  bool appendToLog(const vector<IndexSlot> &records) {
+    if (records.empty())
+      return true;
+    if (!log)
+      return false;
+    bool written = fwrite(records.data(), sizeof(IndexSlot), records.size(),
+                          log) == records.size() &&
+                   sync(log);
+    logRecords += records.size();
+    return written;
+  }
+
+  // compacts when the log has grown to half the index's capacity, since
+  // every recent entry also takes memory
+  void flushPeriodically(chrono::milliseconds interval) {
+    unique_lock<mutex> lock(flusherLock);
+    while (!flusherCondition.wait_for(lock, interval,
+                                      [this] { return exiting; })) {
+      flush();
+      size_t records, slotCount;
+      {
+        lock_guard<mutex> logGuard(logLock);
+        records = logRecords;
+      }
+      {
+        shared_lock<shared_mutex> entriesGuard(entriesLock);
+        slotCount = index.slotCount;
+      }
+      if (records > max<size_t>(1 << 16, slotCount / 2))
+        compact();
+    }
+  }
+
+  string path;
+  unsigned long long fingerprint;
+  int minDepth;
+
+  // guards recent, pending, and replacing merging and index
+  mutable shared_mutex entriesLock;
+  // entries stored since the last compaction
+  unordered_map<unsigned long long, unsigned long long> recent;
+  // entries compact() is merging into a new index, older than recent ones
+  unordered_map<unsigned long long, unsigned long long> merging;
+  // entries stored since the last flush
+  vector<IndexSlot> pending;
+  Index index;
+
+  // held for all of compact(), so only it changes merging and index
+  mutex compactLock;
+
+  // guards log and logRecords
+  mutex logLock;
+  FILE *log = nullptr;
+  size_t logRecords = 0;
+
+  mutex flusherLock;
+  condition_variable flusherCondition;
+  bool exiting = false;
+  thread flusher;
+};
+
+#endif /* POSITIONCACHE_H */
@@ -0,0 +1,201 @@
+#ifndef TRANSPOSITIONTABLE_H
+#define TRANSPOSITIONTABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+using namespace std;
+
+// how a stored score relates to the real score of a position
+enum BOUND { NO_BOUND, EXACT_BOUND, LOWER_BOUND, UPPER_BOUND };
+
+// what is known about a searched position
+struct TableEntry {
+  // score from evaluatePosition()
+  int score = 0;
+  // requiredDepth the score was searched to
+  unsigned char depth = 0;
+  BOUND bound = NO_BOUND;
+  // best column found, or NO_COLUMN
+  unsigned char column = NO_COLUMN;
+  // search the entry was stored in, see TranspositionTable::newSearch()
+  unsigned char age = 0;
+
+  static constexpr unsigned char NO_COLUMN = 15;
+
+  // bit layout of packed entries
+  // 0-31 score, 32-39 depth, 40-41 bound, 42-45 column, 46-53 age
+  unsigned long long pack() const {
+    return (unsigned long long)(unsigned)score |
+           (unsigned long long)depth << 32 | (unsigned long long)bound << 40 |
+           (unsigned long long)(column & 0xF) << 42 |
+           (unsigned long long)age << 46;
+  }
+
+  static TableEntry unpack(unsigned long long data) {
+    TableEntry entry;
+    entry.score = (int)(unsigned)data;
+    entry.depth = data >> 32;
+    entry.bound = BOUND(data >> 40 & 0x3);
+    entry.column = data >> 42 & 0xF;
+    entry.age = data >> 46;
+    return entry;
+  }
+};
+
+// hash table of searched positions shared between any number of threads
+// https://www.chessprogramming.org/Transposition_Table
+// each entry is 2 atomic 64-bit words, the packed data and the key XOR the
+// data, so a torn entry from concurrent writes fails verification instead of
+// being read as another position's data, without any locks
+// https://www.chessprogramming.org/Shared_Hash_Table#Lockless
+class TranspositionTable {
+public:
+  // entries in each cache-line sized bucket
+  static constexpr size_t BUCKET_ENTRIES = 4;
+
+  // allocates about megabytes MiB of entries, using huge pages if requested
+  // and available
+  TranspositionTable(size_t megabytes, bool hugePages = false) {
+    bucketCount = megabytes * (1 << 20) / sizeof(Bucket);
+    if (bucketCount == 0)
+      bucketCount = 1;
+    allocate(hugePages);
+  }
+  TranspositionTable(const TranspositionTable &) = delete;
+  TranspositionTable &operator=(const TranspositionTable &) = delete;
+  ~TranspositionTable() { deallocate(); }
+
+  // marks entries from previous searches as older than new ones
+  void newSearch() { age.fetch_add(1, memory_order_relaxed); }
+
+  // starts loading the bucket of the key into the cache
+  void prefetch(unsigned long long key) const {
+    __builtin_prefetch(&bucketOf(key));
+  }
+
+  // returns whether the key was found, copying its entry if it was
+  bool probe(unsigned long long key, TableEntry &entry) const {
+    const Bucket &bucket = bucketOf(key);
+    for (const Slot &slot : bucket.slots) {
+      unsigned long long data = slot.data.load(memory_order_relaxed);
+      unsigned long long check = slot.check.load(memory_order_relaxed);
+      TableEntry stored = TableEntry::unpack(data);
+      if ((check ^ data) == key && stored.bound != NO_BOUND) {
+        entry = stored;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // stores the entry for the key, replacing the same key or the least
+  // valuable entry in its bucket based on depth and age
+  void store(unsigned long long key, TableEntry entry) {
+    entry.age = age.load(memory_order_relaxed);
+    Bucket &bucket = bucketOf(key);
+    Slot *victim = nullptr;
+    int victimValue = 0;
+    for (Slot &slot : bucket.slots) {
+      unsigned long long data = slot.data.load(memory_order_relaxed);
+      unsigned long long check = slot.check.load(memory_order_relaxed);
+      TableEntry stored = TableEntry::unpack(data);
+      if ((check ^ data) == key) {
+        // keep deeper results of the current search about the same position
+        // unless the new one is exact
+        if (stored.bound != NO_BOUND && stored.age == entry.age &&
+            stored.depth > entry.depth && entry.bound != EXACT_BOUND)
+          return;
+        victim = &slot;
+        break;
+      }
+      int value = replacementValue(stored, entry.age);
+      if (!victim || value < victimValue) {
+        victim = &slot;
+        victimValue = value;
+      }
+    }
+    unsigned long long data = entry.pack();
+    victim->data.store(data, memory_order_relaxed);
+    victim->check.store(key ^ data, memory_order_relaxed);
+  }
+
+  // empties every entry, must not be called during a search
+  void clear() {
+    for (size_t i = 0; i < bucketCount; ++i)
+      for (Slot &slot : buckets[i].slots) {
+        slot.data.store(0, memory_order_relaxed);
+        slot.check.store(0, memory_order_relaxed);
+      }
+  }
+
+  size_t size() const { return bucketCount * BUCKET_ENTRIES; }
+
+private:
+  struct Slot {
+    // key ^ data
+    atomic<unsigned long long> check{0};
+    // packed TableEntry
+    atomic<unsigned long long> data{0};
+  };
+  struct alignas(64) Bucket {
+    Slot slots[BUCKET_ENTRIES];
+  };
+
+  // lower values are replaced first: empty entries, then old or shallow ones
+  static int replacementValue(const TableEntry &stored, unsigned char age) {
+    if (stored.bound == NO_BOUND)
+      return -(1 << 16);
+    unsigned char searchesAgo = age - stored.age;
+    return stored.depth - 8 * searchesAgo;
+  }
+
+  // maps the key onto a bucket without requiring a power of 2 bucket count
+  Bucket &bucketOf(unsigned long long key) const {
+    return buckets[(unsigned __int128)key * bucketCount >> 64];
+  }
+
+  void allocate(bool hugePages) {
+    size_t bytes = bucketCount * sizeof(Bucket);
+#ifdef __linux__
+    void *memory = MAP_FAILED;
+    if (hugePages)
+      memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory == MAP_FAILED) {
+      memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (memory == MAP_FAILED)
+        throw bad_alloc();
+      // ask for transparent huge pages if reserved ones weren't available
+      if (hugePages)
+        madvise(memory, bytes, MADV_HUGEPAGE);
+    }
+    mapped = true;
+#else
+    void *memory = ::operator new(bytes, align_val_t(alignof(Bucket)));
+#endif
+    buckets = static_cast<Bucket *>(memory);
+    for (size_t i = 0; i < bucketCount; ++i)
+      new (&buckets[i]) Bucket();
+  }
+
+  void deallocate() {
+#ifdef __linux__
+    if (mapped)
+      munmap(buckets, bucketCount * sizeof(Bucket));
+#else
+    ::operator delete(buckets, align_val_t(alignof(Bucket)));
+#endif
+  }
+
+  Bucket *buckets = nullptr;
+  size_t bucketCount;
+  bool mapped = false;
+  atomic<unsigned char> age{0};
+};
+
+#endif /* TRANSPOSITIONTABLE_H */
@@ -0,0 +1,281 @@
+// tunes the weights of the position scoring heuristic
+// https://www.chessprogramming.org/Texel%27s_Tuning_Method
+//
+// ./tune generate <games> <positions file>
+//   records positions from self-play games with their outcomes
+// ./tune <positions file> [header]
+//   finds weights that best predict the outcomes and writes them to header,
+//   evalWeights.h by default
+//
+// each line of a positions file is the X and O locations in hexadecimal and
+// the result for X: 1 for a win, 0.5 for a tie, 0 for a loss
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "agent.h"
+#include "batchEvaluator.h"
+#include "bitBoard.h"
+#include "evalWeights.h"
+
+// a recorded position and the result of its game for X
+struct Position {
+  BitBoard board;
+  double result;
+};
+
+unsigned threadCount() {
+  unsigned threads = thread::hardware_concurrency();
+  return threads ? threads : 1;
+}
+
+// returns a column that wins or blocks a win immediately, or -1
+int immediateColumn(BitBoard &board, Disk player) {
+  for (Disk disk : {player, player.counterpart()}) {
+    Agent agent(&board, disk);
+    vector<int> winningMoves = agent.currentWinningMoves();
+    if (winningMoves.size())
+      return winningMoves.front();
+  }
+  return -1;
+}
+
+// plays a game with random opening moves and occasional random moves after
+// them, appending its positions to positions
+void playGame(mt19937 &random, vector<Position> &positions) {
+  constexpr int DEPTH = 6;
+  constexpr int OPENING_MOVES = 4;
+  constexpr int RANDOM_MOVE_PERCENT = 10;
+
+  BitBoard board;
+  TranspositionTable table(4);
+  vector<BitBoard> played;
+  GAME_STATE state = INCOMPLETE;
+  for (int turn = 0; state == INCOMPLETE; ++turn) {
+    Disk disk = board.nextDisk();
+    int col = immediateColumn(board, disk);
+    if (col == -1 && (turn < OPENING_MOVES ||
+                      (int)(random() % 100) < RANDOM_MOVE_PERCENT)) {
+      do
+        col = random() % 8;
+      while (!board.validMove(col));
+    }
+    if (col == -1) {
+      Agent agent(&board, disk, &table);
+      int scores[8];
+      col = agent.searchColumns(scores, DEPTH);
+    }
+    board.addDisk(disk, col);
+    state = board.getState();
+    if (turn >= OPENING_MOVES && state == INCOMPLETE)
+      played.push_back(board);
+  }
+  double result = state == X_VICTORY ? 1 : state == O_VICTORY ? 0 : 0.5;
+  for (const BitBoard &board : played)
+    positions.push_back({board, result});
+}
+
+int generate(int games, const string &fileName) {
+  vector<Position> positions;
+  mutex positionsLock;
+  vector<thread> threads;
+  unsigned threadTotal = threadCount();
+  for (unsigned t = 0; t < threadTotal; ++t)
+    threads.emplace_back([&, t] {
+      mt19937 random(t);
+      vector<Position> played;
+      for (int game = t; game < games; game += threadTotal)
+        playGame(random, played);
+      lock_guard<mutex> lock(positionsLock);
+      positions.insert(positions.end(), played.begin(), played.end());
+    });
+  for (thread &t : threads)
+    t.join();
+
+  ofstream fout(fileName);
+  for (const Position &position : positions)
+    fout << hex << position.board.getXLocations().to_ullong() << ' '
+         << position.board.getOLocations().to_ullong() << dec << ' '
+         << position.result << '\n';
+  cout << "recorded " << positions.size() << " positions from " << games
+       << " games\n";
+  return 0;
+}
+
+// loads positions that aren't over and where neither player can win
+// immediately, since the heuristic can't predict those
+vector<Position> loadQuietPositions(const string &fileName) {
+  ifstream fin(fileName);
+  vector<Position> positions;
+  unsigned long long x, o;
+  double result;
+  while (fin >> hex >> x >> o >> dec >> result) {
+    BitBoard board;
+    // columns are rebuilt bottom up so the column heights are right
+    for (int row = 0; row < 8; ++row)
+      for (int col = 0; col < 8; ++col) {
+        unsigned long long bit = 1ULL << (8 * row + col);
+        if (x & bit)
+          board.addDisk(X, col);
+        else if (o & bit)
+          board.addDisk(O, col);
+      }
+    positions.push_back({board, result});
+  }
+
+  vector<BitBoard> boards;
+  for (const Position &position : positions)
+    boards.push_back(position.board);
+  vector<LeafEvaluation> evaluations = BatchEvaluator::evaluate(boards);
+  vector<Position> quiet;
+  for (size_t i = 0; i < positions.size(); ++i)
+    if (evaluations[i].state == INCOMPLETE && !evaluations[i].threats[X] &&
+        !evaluations[i].threats[O])
+      quiet.push_back(positions[i]);
+  return quiet;
+}
+
+// mean squared error between the results and the win probabilities predicted
+// from the heuristic score, scaled by k
+// positions are split between all cores and evaluated in batches
+double loss(const vector<BitBoard> &boards, const vector<double> &results,
+            const EvalWeights &weights, double k) {
+  constexpr size_t BATCH = 1024;
+  unsigned threadTotal = threadCount();
+  vector<double> errors(threadTotal);
+  vector<thread> threads;
+  for (unsigned t = 0; t < threadTotal; ++t)
+    threads.emplace_back([&, t] {
+      size_t begin = boards.size() * t / threadTotal;
+      size_t end = boards.size() * (t + 1) / threadTotal;
+      LeafEvaluation evaluations[BATCH];
+      double error = 0;
+      for (size_t i = begin; i < end; i += BATCH) {
+        size_t count = min(BATCH, end - i);
+        BatchEvaluator::evaluate(&boards[i], count, evaluations, weights);
+        for (size_t j = 0; j < count; ++j) {
+          int score = evaluations[j].adjacency[X] - evaluations[j].adjacency[O];
+          double predicted = 1 / (1 + exp(-k * score));
+          error += (results[i + j] - predicted) * (results[i + j] - predicted);
+        }
+      }
+      errors[t] = error;
+    });
+  for (thread &t : threads)
+    t.join();
+  double error = 0;
+  for (double e : errors)
+    error += e;
+  return error / boards.size();
+}
+
+void writeHeader(const string &fileName, const EvalWeights &weights,
+                 size_t positions, double error) {
+  ofstream fout(fileName);
+  fout << "#ifndef EVALWEIGHTS_H\n#define EVALWEIGHTS_H\n\n"
+       << "// weights of the position scoring heuristic in "
+          "BitBoard::adjacencyScore()\n"
+       << "// this file is rewritten by tune.cpp, see README.md\n"
+       << "// tuned on " << positions << " positions, mean squared error "
+       << error << "\n\n"
+       << "// directions in the order horizontal, vertical, left diagonal, "
+          "right diagonal\n"
+       << "constexpr int WEIGHT_DIRECTIONS = " << WEIGHT_DIRECTIONS << ";\n"
+       << "// most times adjacent disks can be counted in a direction, since a "
+          "row,\n"
+       << "// column, or diagonal has at most 8 disks\n"
+       << "constexpr int WEIGHT_LEVELS = " << WEIGHT_LEVELS << ";\n\n"
+       << "struct EvalWeights {\n"
+       << "  // adjacency[direction][i] is added for each group of i + 2 disks "
+          "in a row\n"
+       << "  int adjacency[WEIGHT_DIRECTIONS][WEIGHT_LEVELS];\n"
+       << "};\n\n"
+       << "constexpr EvalWeights EVAL_WEIGHTS = {{\n";
+  for (const auto &direction : weights.adjacency) {
+    fout << "    {";
+    for (int i = 0; i < WEIGHT_LEVELS; ++i)
+      fout << direction[i] << (i + 1 < WEIGHT_LEVELS ? ", " : "");
+    fout << "},\n";
+  }
+  fout << "}};\n\n#endif /* EVALWEIGHTS_H */\n";
+}
+
+// quiet positions don't have 4 in a row, so only the weights of 2 and 3 in a
+// row affect their scores, and the others are kept
+constexpr int TUNED_LEVELS = 2;
+// the error keeps improving slightly for many passes on few positions, as
+// weights fit them more closely
+constexpr int MAX_PASSES = 20;
+
+int tune(const string &positionsFile, const string &headerFile) {
+  vector<Position> positions = loadQuietPositions(positionsFile);
+  if (positions.empty()) {
+    cout << "no quiet positions in " << positionsFile << '\n';
+    return 1;
+  }
+  vector<BitBoard> boards;
+  vector<double> results;
+  for (const Position &position : positions) {
+    boards.push_back(position.board);
+    results.push_back(position.result);
+  }
+  cout << "tuning on " << boards.size() << " quiet positions\n";
+
+  EvalWeights weights = EVAL_WEIGHTS;
+  // the scale that best fits the current weights stays fixed while tuning
+  double k = 1;
+  double best = loss(boards, results, weights, k);
+  for (double scale = 1; scale > 1e-3; scale /= 2) {
+    for (bool improvedK = true; improvedK;) {
+      improvedK = false;
+      for (double candidate : {k * (1 + scale), k / (1 + scale)}) {
+        double error = loss(boards, results, weights, candidate);
+        if (error < best) {
+          best = error;
+          k = candidate;
+          improvedK = true;
+        }
+      }
+    }
+  }
+  cout << "k = " << k << ", starting error " << best << '\n';
+
+  // changes one weight at a time by 1 while it improves the error, up to
+  // MAX_PASSES times each
+  bool improved = true;
+  for (int pass = 1; improved && pass <= MAX_PASSES; ++pass) {
+    improved = false;
+    for (auto &direction : weights.adjacency)
+      for (int i = 0; i < TUNED_LEVELS; ++i)
+        for (int delta : {1, -1}) {
+          int &weight = direction[i];
+          weight += delta;
+          double error = loss(boards, results, weights, k);
+          if (error < best) {
+            best = error;
+            improved = true;
+            break;
+          }
+          weight -= delta;
+        }
+    cout << "pass " << pass << ": error " << best << '\n';
+  }
+
+  writeHeader(headerFile, weights, boards.size(), best);
+  cout << "wrote " << headerFile << '\n';
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc >= 4 && string(argv[1]) == "generate")
+    return generate(stoi(argv[2]), argv[3]);
+  if (argc >= 2 && string(argv[1]) != "generate")
+    return tune(argv[1], argc >= 3 ? argv[2] : "evalWeights.h");
+  cout << "usage: " << argv[0] << " generate <games> <positions file>\n"
+       << "       " << argv[0] << " <positions file> [header]\n";
+  return 1;
+}